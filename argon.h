@@ -11,18 +11,170 @@
 #ifndef __ARGON_H
 #define __ARGON_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define HAS_FLAG(x, f) (( (x) & f) == f)
 enum argon_reset_flags {
 	ARGON_RESET_FULL = 1 << 0,
 	ARGON_KEEP_BUFFER = 1 << 1,
 	ARGON_SKIP_GC = 1 << 2,
 	ARGON_FAST_INIT = 1 << 3,
-	ARGON_SKIP_INIT = 1 << 4
+	ARGON_SKIP_INIT = 1 << 4,
+	// the output buffer grows as needed (argon_bfd_data_alloc_growable)
+	ARGON_GROW_BUFFER = 1 << 5,
+	// relaxable instructions always take their longest form (full init only)
+	ARGON_FIXED_SIZE = 1 << 6,
+	// write a relocatable object to memory (argon_object_finish)
+	ARGON_OBJECT_OUTPUT = 1 << 7,
+	// keep the output BFD and its sections open between resets (with ARGON_SKIP_INIT)
+	ARGON_HOT_RESET = 1 << 8,
+	// build the opcode tables (md_begin) on first use (full init only).
+	// md_begin builds them all at once: only fully cached runs skip it
+	ARGON_LAZY_INIT = 1 << 9
 };
 
+// set to 1 to reset the RISC-V and PPC tc state in place on ARGON_SKIP_INIT
+// (not verified on those targets yet); otherwise they do a full init
+#define ARGON_WARM_RESET_ENV "ARGON_WARM_RESET"
+
 enum argon_gc_pool {
 	ARGON_POOL_INIT = 1 << 0,
 	ARGON_POOL_LIVE = 1 << 1
 };
 
+/**
+ * called when a write doesn't fit in the output buffer
+ * @param required size the buffer would need
+ * @param size actual size of the buffer
+ */
+typedef void (*argon_overflow_fn)(size_t required, size_t size, void *opaque);
+
+/** output sections (argon_bfd_data_section_*) **/
+struct argon_section {
+	const char *name;
+	// BFD section flags (SEC_*)
+	unsigned flags;
+	// log2 of the alignment
+	unsigned alignment;
+	size_t size;
+	const uint8_t *data;
+};
+
+/** symbols of the last write (argon_bfd_data_symbol_*) **/
+struct argon_symbol {
+	const char *name;
+	// "*UND*" for undefined symbols
+	const char *section;
+	// relative to the start of the section
+	uint64_t value;
+	// BFD symbol flags (BSF_*)
+	unsigned flags;
+};
+
+/** relocations left after relaxation (argon_bfd_data_fixup_*) **/
+struct argon_fixup {
+	const char *section;
+	// offset of the field in the section
+	uint64_t offset;
+	// size of the field, in bytes
+	unsigned size;
+	// target relocation type (e.g. R_X86_64_PLT32)
+	unsigned type;
+	const char *type_name;
+	int pc_relative;
+	// NULL if the relocation has no symbol
+	const char *symbol;
+	int64_t addend;
+};
+
+/** line cache (cache.c) **/
+// path of the cache file (cache_file.c), loaded by argon_init_gas and saved on full resets
+#define ARGON_CACHE_FILE_ENV "ARGON_CACHE_FILE"
+// size of the in-memory cache enabled along with the cache file
+#define ARGON_CACHE_FILE_ENTRIES 4096
+
+struct argon_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	// lines that can't be cached (relocations, symbols, other sections, errors)
+	uint64_t bypass;
+	// hits served by the cache file (argon_cache_file_open)
+	uint64_t file_hits;
+	size_t entries;
+	size_t capacity;
+};
+
+struct argon_cache_record {
+	// hash of the options and of the line
+	uint64_t hash;
+	// hash of the options the line was assembled with
+	uint64_t options;
+	// normalized line, not NUL terminated
+	const char *line;
+	size_t line_size;
+	// .text contents and attributes
+	const uint8_t *data;
+	size_t size;
+	unsigned flags;
+	unsigned alignment;
+};
+
+/** streaming assembly (stream.c) **/
+struct argon_stream_chunk {
+	// sequence number of the chunk
+	size_t index;
+	// part of the source assembled
+	size_t source_offset;
+	size_t source_size;
+	// .text of the chunk, relative to the start of the stream
+	size_t output_offset;
+	size_t output_size;
+	// 0 on success, -1 if GAS reported errors
+	int status;
+};
+
+/**
+ * called after each chunk of a stream.
+ * @return non zero to stop the stream
+ */
+typedef int (*argon_stream_fn)(const struct argon_stream_chunk *chunk, void *opaque);
+
+/** stencils (stencil.c) **/
+struct argon_stencil;
+
+struct argon_stencil_hole {
+	const char *name;
+	// position of the field in the stencil
+	uint64_t offset;
+	// bytes covered by the field
+	unsigned size;
+	// encoding of the value in the field (BFD howto)
+	unsigned bitsize;
+	unsigned bitpos;
+	unsigned rightshift;
+	int pc_relative;
+	// target relocation type (e.g. R_X86_64_32S)
+	unsigned type;
+	const char *type_name;
+	int64_t addend;
+};
+
+/** worker farm (farm.c) **/
+#define ARGON_FARM_LINE_MAX 1024
+#define ARGON_FARM_OUTPUT_MAX 4096
+#define ARGON_FARM_TRUNCATED -2
+
+struct argon_farm_result {
+	uint64_t id;
+	/**
+	 * 0 on success, -1 if GAS reported errors or the worker died,
+	 * ARGON_FARM_TRUNCATED if the output didn't fit ARGON_FARM_OUTPUT_MAX
+	 * (size is then the part that was kept)
+	 */
+	int status;
+	size_t size;
+};
+
 #endif
\ No newline at end of file
@@ -13,10 +13,26 @@
 #ifndef __ARGON_API_H
 #define __ARGON_API_H
 
+/**
+ * globals that must survive argon_restore(),
+ * i.e. allocator and output state
+ */
+#ifdef __ELF__
+#define ARGON_PERSIST __attribute__((section("argon_persist")))
+#else
+#define ARGON_PERSIST
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void argon_reset_gas(unsigned flags);
+void argon_md_begin();
 int argon_set_option(const char *optname, const char *value);
 int argon_call_pseudo(const char *op, char *args);
 void argon_gcpool_set(int pool_selector);
+int argon_gcpool_get();
 void argon_gc_enable(int enable);
 
 /** wrappers for the real allocator **/
@@ -25,7 +41,107 @@ void argon_free(void *ptr);
 char *argon_strdup(const char *str);
 
 void argon_malloc_gc(int pool_selector);
+size_t argon_gc_pool_size(int pool_selector);
+size_t argon_obstack_chunk_allocs();
 
+/**
+ * output buffers: a fixed size one (argon_bfd_data_alloc, or the one returned
+ * by argon_init_gas) belongs to the caller, who releases it with free()
+ * or argon_bfd_data_free. a growable one belongs to argon: it's released
+ * by argon_bfd_data_free or when the next buffer is allocated
+ */
 void *argon_bfd_data_alloc(size_t size);
+void *argon_bfd_data_alloc_growable(size_t size);
+void argon_bfd_data_free();
+void *argon_bfd_data_get();
+size_t argon_bfd_data_required();
+void argon_bfd_data_set_overflow(argon_overflow_fn fn, void *opaque);
+int argon_bfd_data_set_buffer(void *mem, size_t size, void *exec);
+void *argon_bfd_data_exec_addr();
+void argon_bfd_data_begin();
+size_t argon_bfd_data_section_count();
+int argon_bfd_data_section_get(size_t index, struct argon_section *section);
+int argon_bfd_data_section_find(const char *name, struct argon_section *section);
+size_t argon_bfd_data_symbol_count();
+int argon_bfd_data_symbol_get(size_t index, struct argon_symbol *symbol);
+int argon_bfd_data_symbol_find(const char *name, struct argon_symbol *symbol);
+size_t argon_bfd_data_fixup_count();
+int argon_bfd_data_fixup_get(size_t index, struct argon_fixup *fixup);
+const void *argon_bfd_data_fixup_howto(size_t index);
+int argon_bfd_data_patch(const void *howto, size_t pos, size_t target, int64_t addend);
+void argon_bfd_data_set_vma(uint64_t vma);
+void argon_bfd_data_clear_vma();
+size_t argon_bfd_data_resolved_count();
+size_t argon_bfd_data_overflow_count();
+
+/** heap snapshot (wrappers.cpp) **/
+int argon_gc_checkpoint();
+int argon_gc_restore();
+void argon_gc_checkpoint_drop();
+
+/** GAS state snapshot (checkpoint.c) **/
+int argon_checkpoint();
+int argon_restore();
+
+/** worker farm (farm.c) **/
+int argon_farm_start(unsigned nworkers);
+int argon_farm_submit(const char *line, uint64_t *id);
+int argon_farm_collect(struct argon_farm_result *result, void *buf, size_t buf_size, int wait);
+void argon_farm_stop();
+
+int argon_bfd_data_emit(const char *section_name, unsigned flags, unsigned alignment, const void *data, size_t size);
+
+/** line cache (cache.c) **/
+int argon_cache_init(size_t max_entries);
+void argon_cache_clear();
+void argon_cache_get_stats(struct argon_cache_stats *stats);
+int argon_cache_lookup(const char *text);
+void argon_cache_store(int errors);
+void argon_cache_options_reset();
+void argon_cache_options_update(const char *name, const char *value);
+uint64_t argon_cache_options_hash();
+size_t argon_cache_record_count();
+int argon_cache_record_get(size_t index, struct argon_cache_record *rec);
+int argon_cache_dirty(int clear);
+
+/** cache file (cache_file.c) **/
+int argon_cache_file_open(const char *path);
+void argon_cache_file_close();
+int argon_cache_file_is_open();
+int argon_cache_file_find(uint64_t hash, struct argon_cache_record *rec);
+int argon_cache_file_save(const char *path);
+
+/** streaming assembly (stream.c) **/
+void argon_stream_source_set(const char *name, const void *data, size_t size);
+int argon_assemble_stream(const char *text, size_t size, size_t flush_size, argon_stream_fn fn, void *opaque);
+int argon_assemble_file(const char *path, size_t flush_size, argon_stream_fn fn, void *opaque);
+
+/** relocatable objects (object.c) **/
+int argon_object_finish(void **object, size_t *size);
+int argon_assemble_object(const char *text, size_t size, void **object, size_t *object_size);
+
+/** incremental assembly (session.c) **/
+int argon_session_begin();
+int argon_session_append(const char **lines, size_t n, size_t *offsets);
+int argon_session_collect();
+size_t argon_session_size();
+size_t argon_session_pending();
+int argon_session_label(const char *name, size_t *offset);
+int argon_session_end();
+
+/** stencils (stencil.c) **/
+struct argon_stencil *argon_stencil_create(const char *text);
+void argon_stencil_free(struct argon_stencil *st);
+size_t argon_stencil_size(const struct argon_stencil *st);
+const uint8_t *argon_stencil_data(const struct argon_stencil *st);
+size_t argon_stencil_hole_count(const struct argon_stencil *st);
+int argon_stencil_hole_get(const struct argon_stencil *st, size_t index, struct argon_stencil_hole *hole);
+int argon_stencil_hole_find(const struct argon_stencil *st, const char *name);
+int argon_stencil_patch(const struct argon_stencil *st, void *dst, uint64_t address, size_t index, uint64_t value);
+int argon_stencil_instantiate(const struct argon_stencil *st, void *dst, uint64_t address, const uint64_t *values);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
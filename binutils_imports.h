@@ -1,4 +1,21 @@
-#ifdef BINUTILS_IMPORT_DECL
+#if defined(BINUTILS_IMPORT_STRUCT)
+
+// members of a per-instance import table (see loader.h)
+#define GVAR(T, sym) T sym
+#define GFUNC(ret_type, function, ...) ret_type(*function)(__VA_ARGS__)
+
+#elif defined(BINUTILS_IMPORT_INSTANCE)
+
+// resolve into the import table pointed by BINUTILS_IMPORT_INSTANCE
+#ifdef __cplusplus
+#define GVAR(T, sym) resolveSymbol(#sym, BINUTILS_IMPORT_INSTANCE->sym)
+#define GFUNC(ret_type, function, ...) resolveSymbol(#function, BINUTILS_IMPORT_INSTANCE->function)
+#else
+#define GVAR(T, sym) BINUTILS_IMPORT_INSTANCE->sym = (T)resolveSymbol(#sym)
+#define GFUNC(ret_type, function, ...) BINUTILS_IMPORT_INSTANCE->function = resolveSymbol(#function)
+#endif
+
+#elif defined(BINUTILS_IMPORT_DECL)
 
 #ifdef BINUTILS_IMPORT_GLOBAL
 #define BINUTILS_IMPORT_STATIC
@@ -20,7 +37,7 @@
 #define GFUNC(ret_type, function, ...) function = resolveSymbol(#function)
 #endif
 
-#endif
+#endif // BINUTILS_IMPORT_STRUCT
 
 GFUNC(int, md_parse_option, int c, const char *arg);
 GFUNC(void, md_begin);
@@ -34,7 +51,70 @@ GFUNC(void, write_object_file);
 /** from wrappers.cpp **/
 GFUNC(void *, argon_bfd_data_alloc, size_t);
 GFUNC(size_t, argon_bfd_data_written);
+GFUNC(void, argon_bfd_data_free);
+GFUNC(void *, argon_bfd_data_get);
+GFUNC(size_t, argon_bfd_data_required);
+GFUNC(void, argon_bfd_data_set_overflow, argon_overflow_fn fn, void *opaque);
+GFUNC(int, argon_bfd_data_set_buffer, void *mem, size_t size, void *exec);
+GFUNC(void *, argon_bfd_data_exec_addr);
+GFUNC(void, argon_bfd_data_set_vma, uint64_t vma);
+GFUNC(void, argon_bfd_data_clear_vma);
+GFUNC(size_t, argon_bfd_data_section_count);
+GFUNC(int, argon_bfd_data_section_get, size_t index, struct argon_section *section);
+GFUNC(int, argon_bfd_data_section_find, const char *name, struct argon_section *section);
+GFUNC(size_t, argon_bfd_data_symbol_count);
+GFUNC(int, argon_bfd_data_symbol_get, size_t index, struct argon_symbol *symbol);
+GFUNC(int, argon_bfd_data_symbol_find, const char *name, struct argon_symbol *symbol);
+GFUNC(size_t, argon_bfd_data_fixup_count);
+GFUNC(int, argon_bfd_data_fixup_get, size_t index, struct argon_fixup *fixup);
 GFUNC(void *, argon_tc_pseudo_ops);
+GFUNC(size_t, argon_gc_pool_size, int pool_selector);
+
+/** from checkpoint.c **/
+GFUNC(int, argon_checkpoint);
+GFUNC(int, argon_restore);
+
+/** from farm.c **/
+GFUNC(int, argon_farm_start, unsigned nworkers);
+GFUNC(int, argon_farm_submit, const char *line, uint64_t *id);
+GFUNC(int, argon_farm_collect, struct argon_farm_result *result, void *buf, size_t buf_size, int wait);
+GFUNC(void, argon_farm_stop);
+
+/** from cache.c **/
+GFUNC(int, argon_cache_init, size_t max_entries);
+GFUNC(void, argon_cache_clear);
+GFUNC(void, argon_cache_get_stats, struct argon_cache_stats *stats);
+GFUNC(int, argon_cache_file_open, const char *path);
+GFUNC(void, argon_cache_file_close);
+GFUNC(int, argon_cache_file_save, const char *path);
+
+/** from stream.c **/
+GFUNC(int, argon_assemble_stream, const char *text, size_t size, size_t flush_size, argon_stream_fn fn, void *opaque);
+GFUNC(int, argon_assemble_file, const char *path, size_t flush_size, argon_stream_fn fn, void *opaque);
+
+/** from object.c **/
+GFUNC(int, argon_object_finish, void **object, size_t *size);
+GFUNC(int, argon_assemble_object, const char *text, size_t size, void **object, size_t *object_size);
+
+/** from session.c **/
+GFUNC(int, argon_session_begin);
+GFUNC(int, argon_session_append, const char **lines, size_t n, size_t *offsets);
+GFUNC(int, argon_session_collect);
+GFUNC(size_t, argon_session_size);
+GFUNC(size_t, argon_session_pending);
+GFUNC(int, argon_session_label, const char *name, size_t *offset);
+GFUNC(int, argon_session_end);
+
+/** from stencil.c **/
+GFUNC(struct argon_stencil *, argon_stencil_create, const char *text);
+GFUNC(void, argon_stencil_free, struct argon_stencil *st);
+GFUNC(size_t, argon_stencil_size, const struct argon_stencil *st);
+GFUNC(const uint8_t *, argon_stencil_data, const struct argon_stencil *st);
+GFUNC(size_t, argon_stencil_hole_count, const struct argon_stencil *st);
+GFUNC(int, argon_stencil_hole_get, const struct argon_stencil *st, size_t index, struct argon_stencil_hole *hole);
+GFUNC(int, argon_stencil_hole_find, const struct argon_stencil *st, const char *name);
+GFUNC(int, argon_stencil_patch, const struct argon_stencil *st, void *dst, uint64_t address, size_t index, uint64_t value);
+GFUNC(int, argon_stencil_instantiate, const struct argon_stencil *st, void *dst, uint64_t address, const uint64_t *values);
 
 /** globals **/
 GVAR(void **, stdoutput);
@@ -45,14 +125,22 @@ GFUNC(void, _argon_init_gas, unsigned flags);
 #else
 GFUNC(unsigned char *, argon_init_gas, size_t mem_size, unsigned flags);
 GFUNC(void, argon_assemble, const char *);
+GFUNC(int, argon_assemble_batch, const char **lines, size_t n, size_t *offsets);
+GFUNC(int, argon_assemble_buffer, const char *text, size_t size, size_t *offsets, size_t max_offsets);
+GFUNC(int, argon_assemble_size, const char *text, size_t *size);
+GFUNC(int, argon_assemble_sizes, const char **lines, size_t n, size_t *sizes, uint8_t *relaxable);
 GFUNC(void, argon_assemble_end);
+GFUNC(void, argon_md_begin);
 GFUNC(void, argon_fseek, long offset, int whence);
 #endif
 GFUNC(void, argon_reset_gas, unsigned flags);
 GFUNC(void *, argon_gcmalloc);
+GFUNC(void, argon_free, void *ptr);
 GFUNC(void, argon_clear_htab, void *htab);
 GFUNC(void, argon_call_pseudo, const char *name, const char *args);
 GFUNC(int, argon_set_option, const char *optname, const char *value);
+GFUNC(const char *, argon_arch_name);
+GFUNC(size_t, argon_obstack_chunk_allocs);
 
 #undef GVAR
 #undef GFUNC
@@ -0,0 +1,457 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * @file cache.c
+ * @author Stefano Moioli <smxdev4@gmail.com>
+ * @brief Cache of assembled lines
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) Stefano Moioli 2022
+ */
+#include "as.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bfd.h"
+
+#include "argon.h"
+#include "argon_api.h"
+
+/**
+ * maps a line to the bytes it assembles to, so that argon_assemble
+ * can skip GAS for lines it has already seen.
+ *
+ * the key is the normalized line (whitespace collapsed) plus a hash of
+ * the options applied so far (argon_set_option, argon_call_pseudo), so that
+ * e.g. ".code32" can't return bytes assembled for 64-bit mode.
+ * only self contained outputs are stored: a single .text section,
+ * no symbols and no relocations (i.e. the bytes don't depend on
+ * where they are placed).
+ *
+ * entries live in a flat array, indexed by an open addressing table
+ * (linear probing, backward shift deletion) and chained in LRU order
+ */
+
+#define CACHE_NONE UINT32_MAX
+
+struct cache_entry {
+	uint64_t hash;
+	// options hash at the time the line was assembled
+	uint64_t options;
+	// normalized line, followed by the output bytes
+	char *key;
+	size_t key_size;
+	uint8_t *data;
+	size_t size;
+	// .text section attributes
+	unsigned flags;
+	unsigned alignment;
+	// LRU list, most recent first
+	uint32_t prev;
+	uint32_t next;
+};
+
+struct cache {
+	struct cache_entry *entries;
+	uint32_t nentries;
+	uint32_t max_entries;
+	// entry index per slot, CACHE_NONE if empty
+	uint32_t *slots;
+	uint32_t slot_mask;
+	uint32_t lru_head;
+	uint32_t lru_tail;
+	// normalized line being looked up
+	char *line;
+	size_t line_size;
+	size_t line_capacity;
+	uint64_t line_hash;
+	// the line missed, and its output can be stored
+	int line_pending;
+	// lines were stored since the last argon_cache_file_save
+	int dirty;
+	struct argon_cache_stats stats;
+};
+
+static struct cache g_cache ARGON_PERSIST;
+
+/**
+ * hash of the options applied to GAS.
+ * part of the GAS state: not persistent, so that restoring a checkpoint
+ * brings it back along with the options themselves
+ */
+static uint64_t g_options_hash = 0;
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size){
+	const uint8_t *p = data;
+	for(size_t i=0; i<size; i++){
+		hash ^= p[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t fnv1a_str(uint64_t hash, const char *str){
+	// include the terminator, so that ("ab", "c") != ("a", "bc")
+	return fnv1a(hash, str, strlen(str) + 1);
+}
+
+/**
+ * @brief Forgets the options applied so far.
+ * Called before a full initialization applies the default options
+ */
+void argon_cache_options_reset(){
+	g_options_hash = 0;
+}
+
+/**
+ * @brief Records an option change (argon_set_option, argon_call_pseudo)
+ */
+void argon_cache_options_update(const char *name, const char *value){
+	uint64_t hash = fnv1a_str(g_options_hash ^ FNV_OFFSET, name);
+	if(value != NULL){
+		hash = fnv1a_str(hash, value);
+	}
+	g_options_hash = hash;
+}
+
+/**
+ * @brief Returns a hash of the options applied to GAS
+ */
+uint64_t argon_cache_options_hash(){
+	return g_options_hash;
+}
+
+static void cache_lru_unlink(struct cache *c, uint32_t idx){
+	struct cache_entry *e = &c->entries[idx];
+	if(e->prev != CACHE_NONE) c->entries[e->prev].next = e->next;
+	else c->lru_head = e->next;
+	if(e->next != CACHE_NONE) c->entries[e->next].prev = e->prev;
+	else c->lru_tail = e->prev;
+}
+
+static void cache_lru_push(struct cache *c, uint32_t idx){
+	struct cache_entry *e = &c->entries[idx];
+	e->prev = CACHE_NONE;
+	e->next = c->lru_head;
+	if(c->lru_head != CACHE_NONE) c->entries[c->lru_head].prev = idx;
+	c->lru_head = idx;
+	if(c->lru_tail == CACHE_NONE) c->lru_tail = idx;
+}
+
+static uint32_t cache_slot_find(struct cache *c, uint64_t hash, uint64_t options, const char *key, size_t key_size){
+	for(uint32_t slot = hash & c->slot_mask
+		;c->slots[slot] != CACHE_NONE
+		;slot = (slot + 1) & c->slot_mask
+	){
+		struct cache_entry *e = &c->entries[c->slots[slot]];
+		if(e->hash == hash
+		&& e->options == options
+		&& e->key_size == key_size
+		&& !memcmp(e->key, key, key_size)
+		){
+			return slot;
+		}
+	}
+	return CACHE_NONE;
+}
+
+static void cache_slot_remove(struct cache *c, uint32_t slot){
+	// backward shift: move up the entries that probed past this slot
+	uint32_t hole = slot;
+	for(uint32_t next = (slot + 1) & c->slot_mask
+		;c->slots[next] != CACHE_NONE
+		;next = (next + 1) & c->slot_mask
+	){
+		uint32_t home = c->entries[c->slots[next]].hash & c->slot_mask;
+		// distance from the home slot, with wrap around
+		if(((next - home) & c->slot_mask) >= ((next - hole) & c->slot_mask)){
+			c->slots[hole] = c->slots[next];
+			hole = next;
+		}
+	}
+	c->slots[hole] = CACHE_NONE;
+}
+
+static void cache_free_entries(struct cache *c){
+	for(uint32_t i=0; i<c->nentries; i++){
+		argon_free(c->entries[i].key);
+	}
+	c->nentries = 0;
+	c->lru_head = CACHE_NONE;
+	c->lru_tail = CACHE_NONE;
+	if(c->slots != NULL){
+		memset(c->slots, 0xFF, (c->slot_mask + 1) * sizeof(*c->slots));
+	}
+}
+
+/**
+ * @brief Enables the cache, or changes its size.
+ * Any cached line is dropped
+ *
+ * @param max_entries maximum number of lines, 0 to disable the cache
+ * @return 0 on success, -1 on allocation failure
+ */
+int argon_cache_init(size_t max_entries){
+	struct cache *c = &g_cache;
+	cache_free_entries(c);
+	argon_free(c->entries);
+	argon_free(c->slots);
+	argon_free(c->line);
+	memset(c, 0x00, sizeof(*c));
+	c->lru_head = CACHE_NONE;
+	c->lru_tail = CACHE_NONE;
+
+	if(max_entries == 0){
+		return 0;
+	}
+	if(max_entries >= CACHE_NONE / 2){
+		return -1;
+	}
+
+	// keep the load factor under 1/2
+	uint32_t nslots = 16;
+	while(nslots < max_entries * 2) nslots *= 2;
+
+	c->entries = argon_malloc(max_entries * sizeof(*c->entries));
+	c->slots = argon_malloc(nslots * sizeof(*c->slots));
+	if(c->entries == NULL || c->slots == NULL){
+		argon_free(c->entries);
+		argon_free(c->slots);
+		c->entries = NULL;
+		c->slots = NULL;
+		return -1;
+	}
+	memset(c->slots, 0xFF, nslots * sizeof(*c->slots));
+	c->slot_mask = nslots - 1;
+	c->max_entries = max_entries;
+	c->stats.capacity = max_entries;
+	return 0;
+}
+
+/**
+ * @brief Drops every cached line, keeping the statistics
+ */
+void argon_cache_clear(){
+	g_cache.line_pending = 0;
+	cache_free_entries(&g_cache);
+	g_cache.stats.entries = 0;
+}
+
+void argon_cache_get_stats(struct argon_cache_stats *stats){
+	*stats = g_cache.stats;
+}
+
+/**
+ * @brief Normalizes a line into the cache scratch buffer, and hashes it
+ */
+static int cache_line_prepare(struct cache *c, const char *text){
+	size_t len = strlen(text);
+	if(len + 1 > c->line_capacity){
+		size_t capacity = (c->line_capacity > 0) ? c->line_capacity : 128;
+		while(capacity < len + 1) capacity *= 2;
+		char *mem = argon_malloc(capacity);
+		if(mem == NULL){
+			return -1;
+		}
+		argon_free(c->line);
+		c->line = mem;
+		c->line_capacity = capacity;
+	}
+
+	// trim, and collapse whitespace runs into a single space
+	size_t n = 0;
+	int space = 0;
+	for(const char *p = text; *p != '\0'; p++){
+		if(ISSPACE(*p)){
+			space = (n > 0);
+			continue;
+		}
+		if(space){
+			c->line[n++] = ' ';
+			space = 0;
+		}
+		c->line[n++] = *p;
+	}
+	c->line[n] = '\0';
+	c->line_size = n;
+	c->line_hash = fnv1a(FNV_OFFSET ^ g_options_hash, c->line, n);
+	return 0;
+}
+
+/**
+ * @brief Emits the cached output of a line, if any
+ *
+ * @return 1 on hit, 0 on miss (or if the cache is disabled)
+ */
+int argon_cache_lookup(const char *text){
+	struct cache *c = &g_cache;
+	c->line_pending = 0;
+	if((c->max_entries == 0 && !argon_cache_file_is_open())
+	|| cache_line_prepare(c, text) < 0
+	){
+		return 0;
+	}
+
+	uint32_t slot = (c->max_entries > 0)
+		? cache_slot_find(c, c->line_hash, g_options_hash, c->line, c->line_size)
+		: CACHE_NONE;
+	if(slot == CACHE_NONE){
+		// lines saved by an earlier run
+		struct argon_cache_record rec = {
+			.options = g_options_hash,
+			.line = c->line,
+			.line_size = c->line_size
+		};
+		if(argon_cache_file_find(c->line_hash, &rec) == 0
+		&& argon_bfd_data_emit(TEXT_SECTION_NAME, rec.flags, rec.alignment, rec.data, rec.size) == 0
+		){
+			c->stats.file_hits++;
+			return 1;
+		}
+		c->stats.misses++;
+		c->line_pending = (c->max_entries > 0);
+		return 0;
+	}
+
+	uint32_t idx = c->slots[slot];
+	struct cache_entry *e = &c->entries[idx];
+	if(argon_bfd_data_emit(TEXT_SECTION_NAME, e->flags, e->alignment, e->data, e->size) < 0){
+		c->stats.misses++;
+		return 0;
+	}
+	cache_lru_unlink(c, idx);
+	cache_lru_push(c, idx);
+	c->stats.hits++;
+	return 1;
+}
+
+/**
+ * @brief Checks if the output of the last write can be reused anywhere
+ */
+static int cache_output_is_cacheable(struct argon_section *text){
+	if(argon_bfd_data_fixup_count() > 0
+	// resolved against the address of the buffer (argon_bfd_data_set_vma)
+	|| argon_bfd_data_resolved_count() > 0
+	|| argon_bfd_data_section_count() != 1
+	|| argon_bfd_data_section_find(TEXT_SECTION_NAME, text) < 0
+	){
+		return 0;
+	}
+
+	size_t nsymbols = argon_bfd_data_symbol_count();
+	for(size_t i=0; i<nsymbols; i++){
+		struct argon_symbol sym;
+		if(argon_bfd_data_symbol_get(i, &sym) == 0
+		&& (sym.flags & BSF_SECTION_SYM) == 0
+		){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * @brief Stores the output of the last write, for the line
+ * previously passed to argon_cache_lookup
+ *
+ * @param errors non zero if GAS reported errors for the line
+ */
+void argon_cache_store(int errors){
+	struct cache *c = &g_cache;
+	if(!c->line_pending){
+		return;
+	}
+	c->line_pending = 0;
+
+	struct argon_section text;
+	if(errors || !cache_output_is_cacheable(&text)){
+		c->stats.bypass++;
+		return;
+	}
+
+	char *key = argon_malloc(c->line_size + text.size);
+	if(key == NULL){
+		return;
+	}
+
+	uint32_t idx;
+	if(c->nentries < c->max_entries){
+		idx = c->nentries++;
+	} else {
+		// evict the least recently used line
+		idx = c->lru_tail;
+		struct cache_entry *old = &c->entries[idx];
+		uint32_t slot = cache_slot_find(c, old->hash, old->options, old->key, old->key_size);
+		if(slot != CACHE_NONE){
+			cache_slot_remove(c, slot);
+		}
+		cache_lru_unlink(c, idx);
+		argon_free(old->key);
+		c->stats.evictions++;
+	}
+
+	struct cache_entry *e = &c->entries[idx];
+	e->key = key;
+	memcpy(e->key, c->line, c->line_size);
+	e->key_size = c->line_size;
+	e->hash = c->line_hash;
+	e->options = g_options_hash;
+	e->data = (uint8_t *)&e->key[c->line_size];
+	memcpy(e->data, text.data, text.size);
+	e->size = text.size;
+	e->flags = text.flags;
+	e->alignment = text.alignment;
+
+	uint32_t slot = e->hash & c->slot_mask;
+	while(c->slots[slot] != CACHE_NONE){
+		slot = (slot + 1) & c->slot_mask;
+	}
+	c->slots[slot] = idx;
+	cache_lru_push(c, idx);
+	c->stats.entries = c->nentries;
+	c->dirty = 1;
+}
+
+size_t argon_cache_record_count(){
+	return g_cache.nentries;
+}
+
+/**
+ * @brief Describes a cached line, e.g. to save it
+ *
+ * @return 0 on success, -1 if the index is out of range
+ */
+int argon_cache_record_get(size_t index, struct argon_cache_record *rec){
+	if(index >= g_cache.nentries){
+		return -1;
+	}
+	struct cache_entry *e = &g_cache.entries[index];
+	rec->hash = e->hash;
+	rec->options = e->options;
+	rec->line = e->key;
+	rec->line_size = e->key_size;
+	rec->data = e->data;
+	rec->size = e->size;
+	rec->flags = e->flags;
+	rec->alignment = e->alignment;
+	return 0;
+}
+
+/**
+ * @brief Tells if lines were stored since the last call
+ *
+ * @param clear non zero to reset the flag
+ */
+int argon_cache_dirty(int clear){
+	int dirty = g_cache.dirty;
+	if(clear){
+		g_cache.dirty = 0;
+	}
+	return dirty;
+}
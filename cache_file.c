@@ -0,0 +1,482 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * @file cache_file.c
+ * @author Stefano Moioli <smxdev4@gmail.com>
+ * @brief Line cache saved to disk, shared read-only between processes
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) Stefano Moioli 2022
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "argon.h"
+#include "argon_api.h"
+
+/**
+ * the file is used in place, through a read-only mapping:
+ *
+ * header
+ * buckets   uint32_t[nbuckets], first entry of each chain
+ * entries   struct cache_file_entry[nentries]
+ * blob      line text and output bytes of every entry
+ *
+ * outputs are only valid for the libgas that assembled them,
+ * so the header carries its build id and architecture.
+ * the file is replaced atomically (rename) when saved,
+ * processes that mapped the previous version keep using it
+ */
+
+#define CACHE_FILE_MAGIC "ARGNCACH"
+#define CACHE_FILE_VERSION 1
+#define CACHE_FILE_NONE UINT32_MAX
+#define CACHE_FILE_BUILD_ID_MAX 32
+
+struct cache_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t build_id_size;
+	uint8_t build_id[CACHE_FILE_BUILD_ID_MAX];
+	char arch[16];
+	uint32_t nbuckets;
+	uint32_t nentries;
+	uint64_t buckets_offset;
+	uint64_t entries_offset;
+	uint64_t blob_offset;
+	uint64_t blob_size;
+};
+
+struct cache_file_entry {
+	uint64_t hash;
+	uint64_t options;
+	// next entry in the bucket chain
+	uint32_t next;
+	uint32_t line_size;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t alignment;
+	uint32_t pad;
+	// relative to the blob
+	uint64_t line_offset;
+	uint64_t data_offset;
+};
+
+extern const char *argon_arch_name();
+
+static const uint8_t *cache_map ARGON_PERSIST = NULL;
+static size_t cache_map_size ARGON_PERSIST = 0;
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+#ifndef WIN32
+struct build_id {
+	uint8_t data[CACHE_FILE_BUILD_ID_MAX];
+	size_t size;
+};
+
+static int find_build_id(struct dl_phdr_info *info, size_t size, void *data){
+	(void)size;
+	struct build_id *id = data;
+	uintptr_t self = (uintptr_t)&find_build_id;
+
+	int found = 0;
+	for(int i=0; i<info->dlpi_phnum; i++){
+		const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+		uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+		if(ph->p_type == PT_LOAD && self >= start && self < start + ph->p_memsz){
+			found = 1;
+			break;
+		}
+	}
+	if(!found){
+		return 0;
+	}
+
+	for(int i=0; i<info->dlpi_phnum; i++){
+		const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+		if(ph->p_type != PT_NOTE){
+			continue;
+		}
+		const uint8_t *p = (const uint8_t *)(info->dlpi_addr + ph->p_vaddr);
+		const uint8_t *end = p + ph->p_memsz;
+		while(p + sizeof(ElfW(Nhdr)) <= end){
+			const ElfW(Nhdr) *note = (const ElfW(Nhdr) *)p;
+			const uint8_t *name = p + sizeof(*note);
+			const uint8_t *desc = name + ((note->n_namesz + 3) & ~3);
+			p = desc + ((note->n_descsz + 3) & ~3);
+
+			if(note->n_type == NT_GNU_BUILD_ID
+			&& note->n_namesz == 4 && !memcmp(name, "GNU", 4)
+			&& note->n_descsz <= CACHE_FILE_BUILD_ID_MAX
+			){
+				memcpy(id->data, desc, note->n_descsz);
+				id->size = note->n_descsz;
+				return 1;
+			}
+		}
+	}
+	return 1;
+}
+
+/**
+ * @brief Reads the build id of libgas
+ * @return 0 on success, -1 if libgas has no build id
+ */
+static int cache_file_build_id(struct build_id *id){
+	memset(id, 0x00, sizeof(*id));
+	dl_iterate_phdr(find_build_id, id);
+	return (id->size > 0) ? 0 : -1;
+}
+
+static int cache_file_header_init(struct cache_file_header *hdr){
+	struct build_id id;
+	if(cache_file_build_id(&id) < 0){
+		fputs("argon_cache_file: libgas has no build id\n", stderr);
+		return -1;
+	}
+	memset(hdr, 0x00, sizeof(*hdr));
+	memcpy(hdr->magic, CACHE_FILE_MAGIC, sizeof(hdr->magic));
+	hdr->version = CACHE_FILE_VERSION;
+	hdr->build_id_size = id.size;
+	memcpy(hdr->build_id, id.data, id.size);
+	strncpy(hdr->arch, argon_arch_name(), sizeof(hdr->arch) - 1);
+	return 0;
+}
+
+static const struct cache_file_header *cache_file_header(){
+	return (const struct cache_file_header *)cache_map;
+}
+
+/**
+ * @brief Checks that the file was made by this libgas, and that it's consistent
+ */
+static int cache_file_validate(const uint8_t *map, size_t size){
+	const struct cache_file_header *hdr = (const struct cache_file_header *)map;
+	if(size < sizeof(*hdr)
+	|| memcmp(hdr->magic, CACHE_FILE_MAGIC, sizeof(hdr->magic)) != 0
+	|| hdr->version != CACHE_FILE_VERSION
+	){
+		return -1;
+	}
+
+	struct cache_file_header expected;
+	if(cache_file_header_init(&expected) < 0
+	|| hdr->build_id_size != expected.build_id_size
+	|| memcmp(hdr->build_id, expected.build_id, expected.build_id_size) != 0
+	|| strncmp(hdr->arch, expected.arch, sizeof(hdr->arch)) != 0
+	){
+		// stale: made by another build or for another target
+		return -1;
+	}
+
+	if(hdr->nbuckets == 0 || (hdr->nbuckets & (hdr->nbuckets - 1)) != 0
+	|| hdr->buckets_offset + (uint64_t)hdr->nbuckets * sizeof(uint32_t) > size
+	|| hdr->entries_offset + (uint64_t)hdr->nentries * sizeof(struct cache_file_entry) > size
+	|| hdr->blob_offset + hdr->blob_size > size
+	){
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Fills a record from an entry of the mapped file
+ * @return 0 on success, -1 if the entry is out of bounds
+ */
+static int cache_file_record(const struct cache_file_entry *e, struct argon_cache_record *rec){
+	const struct cache_file_header *hdr = cache_file_header();
+	if(e->line_offset + e->line_size > hdr->blob_size
+	|| e->data_offset + e->size > hdr->blob_size
+	){
+		return -1;
+	}
+	const uint8_t *blob = cache_map + hdr->blob_offset;
+	rec->hash = e->hash;
+	rec->options = e->options;
+	rec->line = (const char *)&blob[e->line_offset];
+	rec->line_size = e->line_size;
+	rec->data = &blob[e->data_offset];
+	rec->size = e->size;
+	rec->flags = e->flags;
+	rec->alignment = e->alignment;
+	return 0;
+}
+#endif
+
+/**
+ * @brief Maps a cache file, read-only.
+ * Files made by a different libgas build or architecture are ignored
+ *
+ * @return 0 on success, -1 if the file is missing or unusable
+ */
+int argon_cache_file_open(const char *path){
+#ifdef WIN32
+	(void)path;
+	return -1;
+#else
+	argon_cache_file_close();
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		return -1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) < 0 || st.st_size == 0){
+		close(fd);
+		return -1;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		perror("mmap");
+		return -1;
+	}
+	if(cache_file_validate(map, st.st_size) < 0){
+		munmap(map, st.st_size);
+		return -1;
+	}
+	cache_map = map;
+	cache_map_size = st.st_size;
+	return 0;
+#endif
+}
+
+void argon_cache_file_close(){
+#ifndef WIN32
+	if(cache_map != NULL){
+		munmap((void *)cache_map, cache_map_size);
+	}
+#endif
+	cache_map = NULL;
+	cache_map_size = 0;
+}
+
+int argon_cache_file_is_open(){
+	return cache_map != NULL;
+}
+
+/**
+ * @brief Looks a line up in the cache file
+ *
+ * @param hash hash of the options and of the line
+ * @param rec options, line and line_size must be set. receives the output
+ * @return 0 on success, -1 if the line isn't in the file
+ */
+int argon_cache_file_find(uint64_t hash, struct argon_cache_record *rec){
+#ifdef WIN32
+	(void)hash;
+	(void)rec;
+	return -1;
+#else
+	if(cache_map == NULL){
+		return -1;
+	}
+	const struct cache_file_header *hdr = cache_file_header();
+	const uint32_t *buckets = (const uint32_t *)(cache_map + hdr->buckets_offset);
+	const struct cache_file_entry *entries = (const struct cache_file_entry *)(cache_map + hdr->entries_offset);
+
+	uint32_t i = buckets[hash & (hdr->nbuckets - 1)];
+	// bounded, in case of a corrupted chain
+	for(uint32_t steps = 0
+		;i < hdr->nentries && steps < hdr->nentries
+		;i = entries[i].next, steps++
+	){
+		const struct cache_file_entry *e = &entries[i];
+		if(e->hash != hash
+		|| e->options != rec->options
+		|| e->line_size != rec->line_size
+		){
+			continue;
+		}
+		struct argon_cache_record found;
+		if(cache_file_record(e, &found) == 0
+		&& !memcmp(found.line, rec->line, rec->line_size)
+		){
+			*rec = found;
+			return 0;
+		}
+	}
+	return -1;
+#endif
+}
+
+/**
+ * @brief Writes the lines of the cache file currently open
+ * and of the in-memory cache to a new cache file
+ *
+ * @return 0 on success, -1 on failure
+ */
+int argon_cache_file_save(const char *path){
+#ifdef WIN32
+	(void)path;
+	return -1;
+#else
+	struct cache_file_header hdr;
+	if(cache_file_header_init(&hdr) < 0){
+		return -1;
+	}
+
+	size_t nmem = argon_cache_record_count();
+	size_t nfile = (cache_map != NULL) ? cache_file_header()->nentries : 0;
+	size_t max = nmem + nfile;
+	if(max == 0 || max >= CACHE_FILE_NONE){
+		return -1;
+	}
+
+	uint32_t nbuckets = 64;
+	while(nbuckets < max) nbuckets *= 2;
+
+	struct argon_cache_record *recs = argon_malloc(max * sizeof(*recs));
+	uint32_t *buckets = argon_malloc(nbuckets * sizeof(*buckets));
+	struct cache_file_entry *entries = argon_malloc(max * sizeof(*entries));
+	// record of each entry
+	uint32_t *entry_rec = argon_malloc(max * sizeof(*entry_rec));
+
+	int rc = -1;
+	FILE *fp = NULL;
+	char *tmp_path = NULL;
+	if(recs == NULL || buckets == NULL || entries == NULL || entry_rec == NULL){
+		goto out;
+	}
+
+	size_t nrecs = 0;
+	for(size_t i=0; i<nmem; i++){
+		if(argon_cache_record_get(i, &recs[nrecs]) == 0){
+			nrecs++;
+		}
+	}
+	if(nfile > 0){
+		const struct cache_file_entry *file_entries = (const struct cache_file_entry *)(
+			cache_map + cache_file_header()->entries_offset);
+		for(size_t i=0; i<nfile; i++){
+			if(cache_file_record(&file_entries[i], &recs[nrecs]) == 0){
+				nrecs++;
+			}
+		}
+	}
+
+	memset(buckets, 0xFF, nbuckets * sizeof(*buckets));
+	uint32_t nentries = 0;
+	uint64_t blob_size = 0;
+	for(size_t i=0; i<nrecs; i++){
+		struct argon_cache_record *rec = &recs[i];
+		uint32_t *bucket = &buckets[rec->hash & (nbuckets - 1)];
+
+		// the same line can be both in memory and in the old file
+		int dup = 0;
+		for(uint32_t j = *bucket; j != CACHE_FILE_NONE; j = entries[j].next){
+			struct argon_cache_record *other = &recs[entry_rec[j]];
+			if(other->hash == rec->hash
+			&& other->options == rec->options
+			&& other->line_size == rec->line_size
+			&& !memcmp(other->line, rec->line, rec->line_size)
+			){
+				dup = 1;
+				break;
+			}
+		}
+		if(dup){
+			continue;
+		}
+
+		struct cache_file_entry *e = &entries[nentries];
+		memset(e, 0x00, sizeof(*e));
+		e->hash = rec->hash;
+		e->options = rec->options;
+		e->next = *bucket;
+		e->line_size = rec->line_size;
+		e->size = rec->size;
+		e->flags = rec->flags;
+		e->alignment = rec->alignment;
+		e->line_offset = blob_size;
+		e->data_offset = blob_size + rec->line_size;
+		blob_size += rec->line_size + rec->size;
+
+		entry_rec[nentries] = i;
+		*bucket = nentries++;
+	}
+
+	hdr.nbuckets = nbuckets;
+	hdr.nentries = nentries;
+	hdr.buckets_offset = ALIGN8(sizeof(hdr));
+	hdr.entries_offset = ALIGN8(hdr.buckets_offset + nbuckets * sizeof(*buckets));
+	hdr.blob_offset = hdr.entries_offset + nentries * sizeof(*entries);
+	hdr.blob_size = blob_size;
+
+	// write a private copy, then replace the file
+	size_t tmp_size = strlen(path) + 32;
+	tmp_path = argon_malloc(tmp_size);
+	if(tmp_path == NULL){
+		goto out;
+	}
+	snprintf(tmp_path, tmp_size, "%s.%ld.tmp", path, (long)getpid());
+
+	fp = fopen(tmp_path, "wb");
+	if(fp == NULL){
+		perror(tmp_path);
+		goto out;
+	}
+
+	static const uint8_t zero[8] = {0};
+	size_t pad_buckets = hdr.buckets_offset - sizeof(hdr);
+	size_t pad_entries = hdr.entries_offset - (hdr.buckets_offset + nbuckets * sizeof(*buckets));
+	if(fwrite(&hdr, sizeof(hdr), 1, fp) != 1
+	|| fwrite(zero, 1, pad_buckets, fp) != pad_buckets
+	|| fwrite(buckets, sizeof(*buckets), nbuckets, fp) != nbuckets
+	|| fwrite(zero, 1, pad_entries, fp) != pad_entries
+	|| fwrite(entries, sizeof(*entries), nentries, fp) != nentries
+	){
+		goto out;
+	}
+	for(uint32_t i=0; i<nentries; i++){
+		struct argon_cache_record *rec = &recs[entry_rec[i]];
+		if(fwrite(rec->line, 1, rec->line_size, fp) != rec->line_size
+		|| fwrite(rec->data, 1, rec->size, fp) != rec->size
+		){
+			goto out;
+		}
+	}
+	if(fclose(fp) != 0){
+		fp = NULL;
+		goto out;
+	}
+	fp = NULL;
+
+	if(rename(tmp_path, path) < 0){
+		perror(path);
+		goto out;
+	}
+	argon_cache_dirty(1);
+	rc = 0;
+
+out:
+	if(fp != NULL){
+		fclose(fp);
+	}
+	if(rc < 0 && tmp_path != NULL){
+		unlink(tmp_path);
+	}
+	argon_free(tmp_path);
+	argon_free(entry_rec);
+	argon_free(entries);
+	argon_free(buckets);
+	argon_free(recs);
+	return rc;
+#endif
+}
@@ -0,0 +1,193 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * @file checkpoint.c
+ * @author Stefano Moioli <smxdev4@gmail.com>
+ * @brief Snapshot and restore of the initialized GAS state
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) Stefano Moioli 2022
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <link.h>
+#endif
+
+#include "argon.h"
+#include "argon_api.h"
+
+/**
+ * GAS, BFD and opcodes keep their state in globals.
+ * since they all live in this shared object, the writable segment
+ * of libgas is the global state: we save it as a whole,
+ * except for the argon_persist section (allocator and output state).
+ * the heap side is handled by argon_gc_checkpoint
+ */
+
+#define MAX_DATA_RANGES 8
+
+struct data_range {
+	uint8_t *start;
+	size_t size;
+};
+
+static struct data_range data_ranges[MAX_DATA_RANGES] ARGON_PERSIST;
+static size_t data_nranges ARGON_PERSIST = 0;
+static uint8_t *data_image ARGON_PERSIST = NULL;
+
+#ifndef WIN32
+// provided by the linker
+extern uint8_t __start_argon_persist[] __attribute__((weak));
+extern uint8_t __stop_argon_persist[] __attribute__((weak));
+
+static int data_range_add(uint8_t *start, uint8_t *end){
+	if(end <= start){
+		return 0;
+	}
+	if(data_nranges >= MAX_DATA_RANGES){
+		return -1;
+	}
+	data_ranges[data_nranges].start = start;
+	data_ranges[data_nranges].size = end - start;
+	data_nranges++;
+	return 0;
+}
+
+/**
+ * @brief Adds a writable range, minus the argon_persist section
+ */
+static int data_range_add_segment(uint8_t *start, uint8_t *end){
+	uint8_t *skip_start = __start_argon_persist;
+	uint8_t *skip_end = __stop_argon_persist;
+	if(skip_start == NULL || skip_end <= start || skip_start >= end){
+		return data_range_add(start, end);
+	}
+	if(data_range_add(start, skip_start) < 0){
+		return -1;
+	}
+	return data_range_add(skip_end, end);
+}
+
+static int find_data_segments(struct dl_phdr_info *info, size_t size, void *data){
+	(void)size;
+	uintptr_t self = (uintptr_t)data;
+
+	int found = 0;
+	uintptr_t relro_end = 0;
+	for(int i=0; i<info->dlpi_phnum; i++){
+		const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+		uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+		switch(ph->p_type){
+			case PT_LOAD:
+				if(self >= start && self < start + ph->p_memsz){
+					found = 1;
+				}
+				break;
+			case PT_GNU_RELRO:
+				// made read-only by the loader after relocation
+				relro_end = start + ph->p_memsz;
+				break;
+		}
+	}
+	if(!found){
+		return 0;
+	}
+
+	for(int i=0; i<info->dlpi_phnum; i++){
+		const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+		if(ph->p_type != PT_LOAD || !(ph->p_flags & PF_W)){
+			continue;
+		}
+		uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+		uintptr_t end = start + ph->p_memsz;
+		if(relro_end > start && relro_end <= end){
+			start = relro_end;
+		}
+		if(data_range_add_segment((uint8_t *)start, (uint8_t *)end) < 0){
+			return -1;
+		}
+	}
+	return 1;
+}
+#endif
+
+/**
+ * @brief Saves the current GAS state.
+ * Meant to be called right after a full initialization, e.g.
+ * argon_init_gas(size, ARGON_RESET_FULL | ARGON_FAST_INIT)
+ *
+ * @return 0 on success, -1 on failure
+ */
+int argon_checkpoint(){
+#ifdef WIN32
+	return -1;
+#else
+	argon_free(data_image);
+	data_image = NULL;
+	data_nranges = 0;
+
+	// or every restore would build the tables again
+	argon_md_begin();
+
+	if(dl_iterate_phdr(find_data_segments, (void *)&argon_checkpoint) != 1){
+		fputs("argon_checkpoint: cannot locate the libgas data segment\n", stderr);
+		data_nranges = 0;
+		return -1;
+	}
+
+	size_t image_size = 0;
+	for(size_t i=0; i<data_nranges; i++){
+		image_size += data_ranges[i].size;
+	}
+
+	// the heap image must be taken first, it changes the allocator state
+	if(argon_gc_checkpoint() < 0){
+		data_nranges = 0;
+		return -1;
+	}
+
+	uint8_t *image = argon_malloc(image_size);
+	if(image == NULL){
+		argon_gc_checkpoint_drop();
+		data_nranges = 0;
+		return -1;
+	}
+	data_image = image;
+
+	for(size_t i=0; i<data_nranges; i++){
+		memcpy(image, data_ranges[i].start, data_ranges[i].size);
+		image += data_ranges[i].size;
+	}
+	return 0;
+#endif
+}
+
+/**
+ * @brief Brings GAS back to the state saved by argon_checkpoint.
+ * This replaces argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT)
+ * between assemble operations.
+ * The output buffer and its position are left untouched
+ *
+ * @return 0 on success, -1 if there is no checkpoint
+ */
+int argon_restore(){
+	if(data_image == NULL || argon_gc_restore() < 0){
+		return -1;
+	}
+
+	const uint8_t *image = data_image;
+	for(size_t i=0; i<data_nranges; i++){
+		memcpy(data_ranges[i].start, image, data_ranges[i].size);
+		image += data_ranges[i].size;
+	}
+	return 0;
+}
@@ -11,6 +11,8 @@
  * 
  */
 #include "as.h"
+#include "subsegs.h"
+#include "obstack.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -42,8 +44,6 @@
 
 static void *resolveSymbol(const char *sym);
 
-extern int __argon_tls_init();
-
 #ifdef WIN32
 static HMODULE gas;
 
@@ -57,16 +57,7 @@ switch( fdwReason ) {
 			// store the DLL handle for dynamic symbol lookup
 			gas = hinstDLL;
 			/**
-			 * https://github.com/msys2/MINGW-packages/issues/2519
-			 * 
-			 * At the very first access of a thread-local object in a new program,
-			 * emutls_init is called via __emutls_get_address.
-			 * This function allocates some memory for the storage using malloc (see emutls_alloc),
-			 * and registers emutls_destroy to be executed at thread exit, using __gthread_key_create.
-			 **/
-			__argon_tls_init();
-			/**
-			 * now that ctors and TLS have been taken care of,
+			 * now that ctors have been taken care of,
 			 * we can enable GC malloc
 			 **/
 			argon_gc_enable(1);
@@ -82,7 +73,6 @@ switch( fdwReason ) {
 }
 #else
 void __attribute__((constructor)) ctor(){
-	__argon_tls_init();
 	argon_gc_enable(1);
 }
 #endif
@@ -96,6 +86,15 @@ static void *resolveSymbol(const char *sym){
 }
 
 extern void _argon_init_gas(unsigned flags);
+extern void argon_set_fixed_size(int enable);
+extern int argon_frag_fixed_var(fragS *fragP);
+extern int argon_frag_min_var(fragS *fragP);
+extern int argon_bfd_object_attach(bfd *abfd);
+extern bfd *argon_hot_openw();
+extern int argon_hot_reset(unsigned flags);
+extern void _argon_reset_gas(unsigned flags, int save_cache);
+extern void argon_option_log_start();
+extern void argon_option_log_replay();
 
 enum argon_arch {
 	ARCH_UNKNOWN,
@@ -125,17 +124,180 @@ static int argon_arch_detect(){
 	return ARCH_UNKNOWN;
 }
 
+/**
+ * @brief Returns the name of the architecture this libgas targets
+ */
+const char *argon_arch_name(){
+	switch(argon_arch_detect()){
+		case ARCH_I386: return "i386";
+		case ARCH_MIPS: return "mips";
+		case ARCH_RISCV: return "riscv";
+		case ARCH_PPC: return "ppc";
+		case ARCH_Z80: return "z80";
+		default: return "unknown";
+	}
+}
+
+/**
+ * tc-*.c state that points into the live pool, and would dangle
+ * after the GC of a warm reset (ARGON_SKIP_INIT).
+ * resolved on full init, reset by arch_warm_reset.
+ * these are static upstream (NOTE: requires patch, see cc_wrap).
+ * arches without an in-place reset are cold: warm resets do a full init
+ */
+// full init flags that a cold warm reset keeps (see argon_init_gas)
+#define WARM_INIT_FLAGS (ARGON_FAST_INIT | ARGON_FIXED_SIZE | ARGON_LAZY_INIT)
+
+static struct {
+	int arch;
+	// ARGON_SKIP_INIT can't be honored, do a full init instead
+	int cold;
+	// mode flags of the last full init, kept by the cold resets
+	unsigned init_flags;
+	// .option push
+	void **riscv_opts_stack;
+	// APUinfo of the instructions seen so far
+	void **ppc_apuinfo_list;
+	unsigned *ppc_apuinfo_num;
+	unsigned *ppc_apuinfo_num_alloc;
+} warm;
+
+// ARGON_LAZY_INIT: md_begin hasn't run yet
+static int md_begin_pending = 0;
+// pool the eager md_begin would have used (ARGON_FAST_INIT)
+static int md_begin_pool = ARGON_POOL_LIVE;
+
+/**
+ * @brief Builds the tc tables (md_begin) if ARGON_LAZY_INIT deferred it.
+ * Called before the first instruction, the first pseudo op
+ * and before the state is shared (argon_checkpoint, argon_farm_start)
+ */
+void argon_md_begin(){
+	if(!md_begin_pending){
+		return;
+	}
+	md_begin_pending = 0;
+	argon_gcpool_set(md_begin_pool);
+	md_begin();
+	argon_gcpool_set(ARGON_POOL_LIVE);
+}
+
+static void arch_warm_reset(){
+	switch(warm.arch){
+		case ARCH_RISCV:
+			*warm.riscv_opts_stack = NULL;
+			break;
+		case ARCH_PPC:
+			*warm.ppc_apuinfo_list = NULL;
+			*warm.ppc_apuinfo_num = 0;
+			*warm.ppc_apuinfo_num_alloc = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * @brief Decides whether warm resets can be done in place (see arch_warm_reset)
+ */
+static void arch_warm_check(){
+	const char *missing = NULL;
+	switch(warm.arch){
+		case ARCH_I386:
+			return;
+		/**
+		 * md_begin keeps state that the GC of a warm reset frees or empties:
+		 * MIPS points mips_regmask_frag/mips_flags_frag into the live pool,
+		 * Z80 enters the register names in the symbol table and keeps
+		 * an expression symbol (zero)
+		 */
+		case ARCH_MIPS:
+		case ARCH_Z80:
+			warm.cold = 1;
+			return;
+		case ARCH_RISCV:
+			if(warm.riscv_opts_stack == NULL) missing = "riscv_opts_stack";
+			break;
+		case ARCH_PPC:
+			if(warm.ppc_apuinfo_list == NULL) missing = "ppc_apuinfo_list";
+			else if(warm.ppc_apuinfo_num == NULL) missing = "ppc_apuinfo_num";
+			else if(warm.ppc_apuinfo_num_alloc == NULL) missing = "ppc_apuinfo_num_alloc";
+			break;
+		default:
+			warm.cold = 1;
+			return;
+	}
+
+	// the RISC-V and PPC in-place resets haven't been run yet: opt-in
+	const char *env = getenv(ARGON_WARM_RESET_ENV);
+	if(env == NULL || strcmp(env, "1") != 0){
+		warm.cold = 1;
+		return;
+	}
+
+	static int warned = 0;
+	if(missing != NULL && !warned){
+		fprintf(stderr, "argon: %s isn't exported (unpatched binutils?), "
+			"ARGON_SKIP_INIT falls back to a full init\n", missing);
+		warned = 1;
+	}
+	warm.cold = (missing != NULL);
+}
+
+/**
+ * @brief Opens the output BFD of a relocatable object, written to memory
+ */
+static bfd *object_openw(){
+	bfd *abfd = bfd_openw("argon.o", TARGET_FORMAT);
+	if(abfd == NULL){
+		return NULL;
+	}
+	if(argon_bfd_object_attach(abfd) < 0
+	|| !bfd_set_format(abfd, bfd_object)
+	){
+		bfd_close_all_done(abfd);
+		return NULL;
+	}
+	bfd_set_arch_mach(abfd, TARGET_ARCH, TARGET_MACH);
+	return abfd;
+}
+
 uint8_t *argon_init_gas(size_t bufferSize, unsigned flags){
-	argon_reset_gas(flags);
+	/**
+	 * the tc state can't be reset in place: start over, in the mode
+	 * of the last full init, and apply the options set since then again.
+	 * the cache file is only saved by real full resets
+	 */
+	int cold_init = HAS_FLAG(flags, ARGON_SKIP_INIT) && warm.cold;
+	if(cold_init){
+		flags &= ~(ARGON_SKIP_INIT | WARM_INIT_FLAGS);
+		flags |= ARGON_RESET_FULL | warm.init_flags;
+	}
+	if(argon_hot_reset(flags) == 0){
+		_argon_init_gas(flags);
+		arch_warm_reset();
+		return NULL;
+	}
+	_argon_reset_gas(flags, !cold_init);
 
 	uint8_t *mem = NULL;
 	if(!HAS_FLAG(flags, ARGON_KEEP_BUFFER)){
-		mem = (uint8_t *)argon_bfd_data_alloc(bufferSize);
+		mem = HAS_FLAG(flags, ARGON_GROW_BUFFER)
+			? (uint8_t *)argon_bfd_data_alloc_growable(bufferSize)
+			: (uint8_t *)argon_bfd_data_alloc(bufferSize);
 	}
 
-	stdoutput = bfd_openw("dummy", "default");
+	if(HAS_FLAG(flags, ARGON_OBJECT_OUTPUT)){
+		stdoutput = object_openw();
+	} else if(HAS_FLAG(flags, ARGON_HOT_RESET)){
+		stdoutput = argon_hot_openw();
+	} else {
+		stdoutput = bfd_openw("dummy", "default");
+	}
 	if(stdoutput == NULL){
-		free(mem);
+		if(mem != NULL){
+			argon_bfd_data_free();
+		}
 		fprintf(stderr, "bfd_openw() failed\n");
 		return NULL;
 	}
@@ -144,8 +306,28 @@ uint8_t *argon_init_gas(size_t bufferSize, unsigned flags){
 	
 	//md_parse_option('V', NULL);
 
-	if(!HAS_FLAG(flags, ARGON_SKIP_INIT)){
+	if(HAS_FLAG(flags, ARGON_SKIP_INIT)){
+		arch_warm_reset();
+	} else {
+	// tables of a previous lazy init are gone
+	md_begin_pending = 0;
+	// the default options are applied again
+	argon_cache_options_reset();
+	argon_set_fixed_size(HAS_FLAG(flags, ARGON_FIXED_SIZE));
+
+	/**
+	 * options can allocate (e.g. riscv_subsets), and must survive
+	 * the warm resets just like the tables built by md_begin
+	 */
+	int fast_init = HAS_FLAG(flags, ARGON_FAST_INIT);
+	if(fast_init){
+		argon_gcpool_set(ARGON_POOL_INIT);
+	}
+
 	int arch = argon_arch_detect();
+	memset(&warm, 0x00, sizeof(warm));
+	warm.arch = arch;
+	warm.init_flags = flags & WARM_INIT_FLAGS;
 		switch(arch){
 			case ARCH_I386:;
 				argon_set_option("64", NULL);
@@ -178,6 +360,11 @@ uint8_t *argon_init_gas(size_t bufferSize, unsigned flags){
 				if(ppc_macro_hash != NULL){
 					memset(ppc_macro_hash, 0x00, sizeof(*ppc_macro_hash));
 				}
+
+				// NOTE: requires patch
+				warm.ppc_apuinfo_list = resolveSymbol("ppc_apuinfo_list");
+				warm.ppc_apuinfo_num = resolveSymbol("ppc_apuinfo_num");
+				warm.ppc_apuinfo_num_alloc = resolveSymbol("ppc_apuinfo_num_alloc");
 				break;
 			case ARCH_RISCV:;
 				GFUNC(void, riscv_after_parse_args);
@@ -191,6 +378,9 @@ uint8_t *argon_init_gas(size_t bufferSize, unsigned flags){
 
 				// inits riscv_subsets
 				riscv_after_parse_args();
+
+				// NOTE: requires patch
+				warm.riscv_opts_stack = resolveSymbol("riscv_opts_stack");
 				break;
 			case ARCH_Z80:;
 				// enable all instructions
@@ -198,26 +388,56 @@ uint8_t *argon_init_gas(size_t bufferSize, unsigned flags){
 				argon_set_option("full", NULL);
 				break;
 		}
+		arch_warm_check();
 
-		int fast_init = HAS_FLAG(flags, ARGON_FAST_INIT);
-		if(fast_init){
-			argon_gcpool_set(ARGON_POOL_INIT);
+		/**
+		 * the opcode tables are built on first use.
+		 * md_begin builds all of them at once, so this only saves time
+		 * when no instruction or pseudo op reaches GAS (every line is cached)
+		 */
+		md_begin_pending = HAS_FLAG(flags, ARGON_LAZY_INIT);
+		md_begin_pool = fast_init ? ARGON_POOL_INIT : ARGON_POOL_LIVE;
+		if(!md_begin_pending){
+			md_begin();
 		}
-		md_begin();
 		if(fast_init){
 			argon_gcpool_set(ARGON_POOL_LIVE);
 		}
+
+		if(cold_init){
+			argon_option_log_replay();
+		} else {
+			argon_option_log_start();
+		}
+
+		// lines assembled by earlier runs, shared between processes
+		const char *cache_path = getenv(ARGON_CACHE_FILE_ENV);
+		if(cache_path != NULL && !argon_cache_file_is_open()){
+			struct argon_cache_stats stats;
+			argon_cache_get_stats(&stats);
+			if(stats.capacity == 0){
+				argon_cache_init(ARGON_CACHE_FILE_ENTRIES);
+			}
+			argon_cache_file_open(cache_path);
+		}
 	}
 
 	return mem;
 }
 
 void argon_assemble(const char *text){
+	// already seen, with the same options
+	if(argon_cache_lookup(text)){
+		return;
+	}
+	int errors = had_errors();
+
 	/**
 	 * IMPORTANT: md_assemble modifies the input line
 	 * so we must always make a copy 
 	 */
 	char *line = argon_strdup(text);
+	argon_md_begin();
 	{
 		// this writes in the current fragment
 		md_assemble(line);
@@ -230,5 +450,309 @@ void argon_assemble(const char *text){
 	 * intermediate output is complicated to achieve,
 	 * due to certain operations being delayed due to relaxation
 	 **/
+	argon_bfd_data_begin();
+	write_object_file();
+	argon_cache_store(had_errors() > errors);
+}
+
+/**
+ * position of a line in the output, before relaxation.
+ * frag addresses are only final after write_object_file
+ */
+struct line_mark {
+	fragS *frag;
+	addressT offset;
+};
+
+// scratch copy of the current line (md_assemble modifies it)
+static char *line_buffer ARGON_PERSIST = NULL;
+static size_t line_buffer_size ARGON_PERSIST = 0;
+
+static char *line_buffer_copy(const char *text, size_t size){
+	if(size + 1 > line_buffer_size){
+		size_t new_size = (line_buffer_size > 0) ? line_buffer_size : 128;
+		while(new_size < size + 1) new_size *= 2;
+
+		char *mem = argon_malloc(new_size);
+		if(mem == NULL){
+			return NULL;
+		}
+		argon_free(line_buffer);
+		line_buffer = mem;
+		line_buffer_size = new_size;
+	}
+	memcpy(line_buffer, text, size);
+	line_buffer[size] = '\0';
+	return line_buffer;
+}
+
+/**
+ * @brief Assembles a label definition ("name:") or an instruction
+ * 
+ * @param line modified in place
+ */
+static void assemble_line(char *line){
+	while(ISSPACE(*line)) line++;
+	if(*line == '\0'){
+		return;
+	}
+
+	if(is_name_beginner(*line)){
+		char *p = line + 1;
+		while(is_part_of_name(*p)) p++;
+		if(*p == ':'){
+			char *end = p + 1;
+			while(ISSPACE(*end)) end++;
+			if(*end == '\0'){
+				*p = '\0';
+				colon(line);
+				return;
+			}
+		}
+	}
+	argon_md_begin();
+	md_assemble(line);
+}
+
+static void line_mark_set(struct line_mark *mark){
+	mark->frag = frag_now;
+	mark->offset = frag_now_fix();
+}
+
+/**
+ * @brief Writes the object file, then translates the line marks into output offsets
+ * 
+ * @return 0 on success, -1 if GAS reported errors
+ */
+static int assemble_finish(const struct line_mark *marks, size_t n, size_t *offsets, int errors){
+	argon_bfd_data_begin();
 	write_object_file();
+
+	if(offsets != NULL){
+		for(size_t i=0; i<n; i++){
+			offsets[i] = marks[i].frag->fr_address + marks[i].offset;
+		}
+	}
+	return (had_errors() > errors) ? -1 : 0;
+}
+
+/**
+ * @brief Assembles several lines with a single write_object_file.
+ * Lines can be instructions or label definitions ("name:"),
+ * references between lines are resolved by relaxation
+ * 
+ * @param lines lines to assemble
+ * @param n number of lines
+ * @param[out] offsets if not NULL, receives the offset of each line in .text
+ * @return 0 on success, -1 if GAS reported errors
+ */
+int argon_assemble_batch(const char **lines, size_t n, size_t *offsets){
+	struct line_mark *marks = NULL;
+	if(offsets != NULL && n > 0){
+		marks = argon_malloc(n * sizeof(*marks));
+		if(marks == NULL){
+			return -1;
+		}
+	}
+
+	int errors = had_errors();
+	for(size_t i=0; i<n; i++){
+		if(marks != NULL){
+			line_mark_set(&marks[i]);
+		}
+		char *line = line_buffer_copy(lines[i], strlen(lines[i]));
+		if(line == NULL){
+			argon_free(marks);
+			return -1;
+		}
+		assemble_line(line);
+	}
+
+	int rc = assemble_finish(marks, n, offsets, errors);
+	argon_free(marks);
+	return rc;
+}
+
+/**
+ * @brief Same as argon_assemble_batch, with newline separated lines
+ * 
+ * @param text lines to assemble, not necessarily NUL terminated
+ * @param size size of text
+ * @param[out] offsets if not NULL, receives the offset of each line in .text
+ * @param max_offsets size of the offsets array. extra lines are assembled,
+ *   but their offset isn't reported
+ * @return number of lines, or -1 if GAS reported errors
+ */
+int argon_assemble_buffer(const char *text, size_t size, size_t *offsets, size_t max_offsets){
+	if(offsets == NULL){
+		max_offsets = 0;
+	}
+
+	struct line_mark *marks = NULL;
+	if(max_offsets > 0){
+		marks = argon_malloc(max_offsets * sizeof(*marks));
+		if(marks == NULL){
+			return -1;
+		}
+	}
+
+	int errors = had_errors();
+	size_t nlines = 0;
+	for(const char *p = text, *end = text + size; p < end; nlines++){
+		const char *eol = memchr(p, '\n', end - p);
+		if(eol == NULL){
+			eol = end;
+		}
+
+		if(nlines < max_offsets){
+			line_mark_set(&marks[nlines]);
+		}
+		char *line = line_buffer_copy(p, eol - p);
+		if(line == NULL){
+			argon_free(marks);
+			return -1;
+		}
+		assemble_line(line);
+		p = eol + 1;
+	}
+
+	size_t nmarks = (nlines < max_offsets) ? nlines : max_offsets;
+	int rc = assemble_finish(marks, nmarks, offsets, errors);
+	argon_free(marks);
+	return (rc < 0) ? -1 : (int)nlines;
+}
+
+/**
+ * @brief Computes the size of the output since a line mark,
+ * before relaxation
+ *
+ * @param[out] relaxable set to 1 if relaxation can grow the output
+ */
+static size_t line_mark_size(const struct line_mark *mark, int *relaxable){
+	size_t size = 0;
+	addressT start = mark->offset;
+	for(fragS *f = mark->frag; f != frag_now; f = f->fr_next){
+		size += f->fr_fix - start;
+		start = 0;
+
+		if(f->fr_type == rs_fill){
+			size += f->fr_var * f->fr_offset;
+			continue;
+		}
+		int fixed_var = argon_frag_fixed_var(f);
+		if(fixed_var >= 0){
+			// longest form (ARGON_FIXED_SIZE)
+			size += fixed_var;
+			continue;
+		}
+		/**
+		 * variable part, at its smallest.
+		 * fr_var isn't a length for every target (tc-i386 keeps the reloc type in it),
+		 * and alignment frags depend on where the line ends up: count them as empty
+		 */
+		int min_var = argon_frag_min_var(f);
+		if(min_var > 0){
+			size += min_var;
+		}
+		*relaxable = 1;
+	}
+	return size + frag_now_fix() - start;
+}
+
+/**
+ * @brief Drops the output of a measured line,
+ * including the frags it opened (e.g. for a branch)
+ * 
+ * @param saved copy of the marked frag header, taken by line_mark_set
+ */
+static void line_mark_rewind(const struct line_mark *mark, const fragS *saved, fixS *fix_tail){
+	struct obstack *ob = &frchain_now->frch_obstack;
+	fragS *frag = mark->frag;
+	if(frag_now != frag){
+		/**
+		 * frags are never moved by the obstack (frag_grow opens a new one instead),
+		 * so freeing from the marked frag releases the chunks taken by the new ones
+		 * while leaving the marked frag where it is
+		 */
+		obstack_free(ob, frag);
+		// make it the growing object again, as frag_alloc left it
+		memcpy(frag, saved, offsetof(fragS, fr_literal));
+		ob->object_base = frag->fr_literal;
+		ob->next_free = frag->fr_literal + mark->offset;
+		frag_now = frag;
+		frchain_now->frch_last = frag;
+	} else {
+		obstack_blank_fast(ob, -(long)(frag_now_fix() - mark->offset));
+	}
+
+	if(fix_tail == NULL){
+		frchain_now->fix_root = NULL;
+	} else {
+		fix_tail->fx_next = NULL;
+	}
+	frchain_now->fix_tail = fix_tail;
+}
+
+/**
+ * @brief Computes the size of a line, without writing it.
+ * The line isn't part of the next write
+ * 
+ * @param text the line
+ * @param[out] size size of the line. for relaxable instructions (e.g. branches),
+ *   the size of the shortest form
+ * @return 0 if the size is final, 1 if relaxation can grow it, -1 if GAS reported errors
+ */
+int argon_assemble_size(const char *text, size_t *size){
+	*size = 0;
+	char *line = line_buffer_copy(text, strlen(text));
+	if(line == NULL){
+		return -1;
+	}
+	while(ISSPACE(*line)) line++;
+	if(*line == '\0'){
+		return 0;
+	}
+
+	int errors = had_errors();
+	struct line_mark mark;
+	line_mark_set(&mark);
+	fixS *fix_tail = frchain_now->fix_tail;
+	fragS saved;
+	memcpy(&saved, mark.frag, offsetof(fragS, fr_literal));
+
+	argon_md_begin();
+	md_assemble(line);
+
+	int relaxable = 0;
+	*size = line_mark_size(&mark, &relaxable);
+	line_mark_rewind(&mark, &saved, fix_tail);
+
+	if(had_errors() > errors){
+		return -1;
+	}
+	return relaxable;
+}
+
+/**
+ * @brief Same as argon_assemble_size, for several lines
+ * 
+ * @param lines lines to measure
+ * @param n number of lines
+ * @param[out] sizes receives the size of each line (0 on error)
+ * @param[out] relaxable if not NULL, receives 1 for each line that relaxation can grow
+ * @return 0 on success, -1 if GAS reported errors
+ */
+int argon_assemble_sizes(const char **lines, size_t n, size_t *sizes, uint8_t *relaxable){
+	int rc = 0;
+	for(size_t i=0; i<n; i++){
+		int status = argon_assemble_size(lines[i], &sizes[i]);
+		if(status < 0){
+			sizes[i] = 0;
+			rc = -1;
+		}
+		if(relaxable != NULL){
+			relaxable[i] = (status == 1);
+		}
+	}
+	return rc;
 }
@@ -0,0 +1,474 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * @file farm.c
+ * @author Stefano Moioli <smxdev4@gmail.com>
+ * @brief Pre-forked assembler workers
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) Stefano Moioli 2022
+ */
+#include "as.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifndef WIN32
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "argon.h"
+#include "argon_api.h"
+
+/**
+ * GAS can only assemble one thing at a time per process.
+ * the parent initializes GAS once, then forks workers that inherit
+ * the initialized state (opcode tables, po_hash, the GC pools) copy-on-write.
+ *
+ * every worker owns a pair of single-producer/single-consumer rings
+ * in shared memory: jobs flow from the parent to the worker,
+ * results flow back to the parent.
+ * the parent never keeps more than FARM_DEPTH jobs in flight per worker,
+ * so a worker never has to wait for room in its result ring
+ */
+
+#define FARM_DEPTH 16
+
+// how often a blocking collect checks that the workers are still alive
+#define FARM_POLL_MS 100
+
+// marks the job that tells a worker to exit
+#define FARM_JOB_STOP UINT32_MAX
+
+extern uint8_t *argon_init_gas(size_t bufferSize, unsigned flags);
+extern void argon_assemble(const char *text);
+extern size_t argon_bfd_data_written();
+extern void argon_fseek(long offset, int whence);
+
+#ifndef WIN32
+struct farm_job {
+	uint64_t id;
+	uint32_t size;
+	char text[ARGON_FARM_LINE_MAX];
+};
+
+struct farm_result {
+	uint64_t id;
+	int32_t status;
+	uint32_t size;
+	uint8_t data[ARGON_FARM_OUTPUT_MAX];
+};
+
+struct farm_worker {
+	pid_t pid;
+	// filled slots of each ring
+	sem_t jobs;
+	sem_t results;
+	// head is written by the producer, tail by the consumer
+	uint32_t job_head;
+	uint32_t job_tail;
+	uint32_t res_head;
+	uint32_t res_tail;
+	// parent only
+	unsigned inflight;
+	int dead;
+	// one extra slot for the stop job
+	struct farm_job job_ring[FARM_DEPTH + 1];
+	struct farm_result res_ring[FARM_DEPTH];
+};
+
+struct farm {
+	unsigned nworkers;
+	// results ready, summed over all workers
+	sem_t results_ready;
+	uint64_t next_id;
+	unsigned next_worker;
+	unsigned next_collect;
+	struct farm_worker workers[];
+};
+
+static struct farm *g_farm ARGON_PERSIST = NULL;
+static size_t g_farm_size ARGON_PERSIST = 0;
+
+static int sem_wait_nointr(sem_t *sem){
+	int rc;
+	while((rc = sem_wait(sem)) < 0 && errno == EINTR);
+	return rc;
+}
+
+static int sem_timedwait_ms(sem_t *sem, long ms){
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if(ts.tv_nsec >= 1000000000L){
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	int rc;
+	while((rc = sem_timedwait(sem, &ts)) < 0 && errno == EINTR);
+	return rc;
+}
+
+static void farm_worker_run(struct farm *farm, struct farm_worker *w){
+	// private output buffer (the parent's one is shared copy-on-write)
+	uint8_t *mem = argon_bfd_data_alloc(ARGON_FARM_OUTPUT_MAX);
+	if(mem == NULL){
+		_exit(EXIT_FAILURE);
+	}
+
+	for(;;){
+		if(sem_wait_nointr(&w->jobs) < 0){
+			_exit(EXIT_FAILURE);
+		}
+		struct farm_job *job = &w->job_ring[w->job_tail % (FARM_DEPTH + 1)];
+		if(job->size == FARM_JOB_STOP){
+			break;
+		}
+
+		// prefer the saved state, if the parent made a checkpoint
+		if(argon_restore() < 0){
+			argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+		}
+		argon_fseek(0, SEEK_SET);
+
+		int errors = had_errors();
+		argon_assemble(job->text);
+
+		struct farm_result *res = &w->res_ring[w->res_head % FARM_DEPTH];
+		res->id = job->id;
+		res->status = (had_errors() > errors) ? -1 : 0;
+		if(res->status == 0 && argon_bfd_data_required() > ARGON_FARM_OUTPUT_MAX){
+			// the buffer is fixed size: only the beginning was kept
+			res->status = ARGON_FARM_TRUNCATED;
+		}
+		res->size = argon_bfd_data_written();
+		memcpy(res->data, mem, res->size);
+		w->job_tail++;
+
+		w->res_head++;
+		sem_post(&w->results);
+		sem_post(&farm->results_ready);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static void farm_worker_stop(struct farm_worker *w){
+	struct farm_job *job = &w->job_ring[w->job_head % (FARM_DEPTH + 1)];
+	job->size = FARM_JOB_STOP;
+	w->job_head++;
+	sem_post(&w->jobs);
+}
+#endif
+
+/**
+ * @brief Forks the assembler workers.
+ * GAS must be fully initialized already; if a checkpoint was made
+ * (argon_checkpoint), workers restore it between jobs
+ *
+ * @param nworkers number of worker processes
+ * @return 0 on success, -1 on failure
+ */
+int argon_farm_start(unsigned nworkers){
+#ifdef WIN32
+	(void)nworkers;
+	fputs("argon_farm_start: fork() not supported on Windows\n", stderr);
+	return -1;
+#else
+	if(g_farm != NULL || nworkers == 0){
+		return -1;
+	}
+	// built once, shared with the workers
+	argon_md_begin();
+
+	size_t size = sizeof(struct farm) + nworkers * sizeof(struct farm_worker);
+	struct farm *farm = mmap(NULL, size,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS,
+		-1, 0);
+	if(farm == MAP_FAILED){
+		perror("mmap");
+		return -1;
+	}
+	memset(farm, 0x00, size);
+
+	if(sem_init(&farm->results_ready, 1, 0) < 0){
+		munmap(farm, size);
+		return -1;
+	}
+
+	g_farm = farm;
+	g_farm_size = size;
+
+	// make sure buffered output isn't flushed by every child
+	fflush(stdout);
+	fflush(stderr);
+
+	for(unsigned i=0; i<nworkers; i++){
+		struct farm_worker *w = &farm->workers[i];
+		if(sem_init(&w->jobs, 1, 0) < 0){
+			argon_farm_stop();
+			return -1;
+		}
+		if(sem_init(&w->results, 1, 0) < 0){
+			sem_destroy(&w->jobs);
+			argon_farm_stop();
+			return -1;
+		}
+
+		pid_t pid = fork();
+		if(pid < 0){
+			perror("fork");
+			// this slot isn't counted in nworkers
+			sem_destroy(&w->jobs);
+			sem_destroy(&w->results);
+			argon_farm_stop();
+			return -1;
+		}
+		if(pid == 0){
+			farm_worker_run(farm, w);
+		}
+		w->pid = pid;
+		farm->nworkers++;
+	}
+	return 0;
+#endif
+}
+
+/**
+ * @brief Queues a line for assembly
+ *
+ * @param line text to assemble
+ * @param[out] id identifier of the job, reported back by argon_farm_collect
+ * @return 0 on success,
+ *   -1 if all workers are busy (collect some results first) or on error
+ */
+int argon_farm_submit(const char *line, uint64_t *id){
+#ifdef WIN32
+	(void)line;
+	(void)id;
+	return -1;
+#else
+	struct farm *farm = g_farm;
+	if(farm == NULL){
+		return -1;
+	}
+
+	size_t size = strlen(line);
+	if(size >= ARGON_FARM_LINE_MAX){
+		return -1;
+	}
+
+	// round robin, skipping the workers that are full or gone
+	struct farm_worker *w = NULL;
+	for(unsigned i=0; i<farm->nworkers; i++){
+		struct farm_worker *cand = &farm->workers[farm->next_worker];
+		farm->next_worker = (farm->next_worker + 1) % farm->nworkers;
+		if(!cand->dead && cand->inflight < FARM_DEPTH){
+			w = cand;
+			break;
+		}
+	}
+	if(w == NULL){
+		return -1;
+	}
+
+	struct farm_job *job = &w->job_ring[w->job_head % (FARM_DEPTH + 1)];
+	job->id = farm->next_id++;
+	job->size = size;
+	memcpy(job->text, line, size + 1);
+
+	w->inflight++;
+	w->job_head++;
+	sem_post(&w->jobs);
+
+	if(id != NULL){
+		*id = job->id;
+	}
+	return 0;
+#endif
+}
+
+#ifndef WIN32
+static void farm_result_copy(struct argon_farm_result *result, void *buf, size_t buf_size,
+	struct farm_worker *w
+){
+	struct farm_result *res = &w->res_ring[w->res_tail % FARM_DEPTH];
+	result->id = res->id;
+	result->status = res->status;
+	result->size = res->size;
+	memcpy(buf, res->data, (res->size < buf_size) ? res->size : buf_size);
+
+	w->res_tail++;
+	w->inflight--;
+}
+
+/**
+ * @brief Takes a result that was signalled through results_ready
+ */
+static int farm_take_result(struct farm *farm, struct argon_farm_result *result, void *buf, size_t buf_size){
+	for(unsigned i=0; i<farm->nworkers; i++){
+		struct farm_worker *w = &farm->workers[farm->next_collect];
+		farm->next_collect = (farm->next_collect + 1) % farm->nworkers;
+		if(sem_trywait(&w->results) < 0){
+			continue;
+		}
+		farm_result_copy(result, buf, buf_size, w);
+		return 1;
+	}
+
+	// unreachable: results_ready counts the filled slots
+	return -1;
+}
+
+/**
+ * @brief Marks the workers that exited
+ *
+ * @return number of workers still alive
+ */
+static int farm_reap(struct farm *farm){
+	int alive = 0;
+	for(unsigned i=0; i<farm->nworkers; i++){
+		struct farm_worker *w = &farm->workers[i];
+		if(!w->dead && waitpid(w->pid, NULL, WNOHANG) == w->pid){
+			fprintf(stderr, "argon_farm: worker %d exited unexpectedly\n", (int)w->pid);
+			w->dead = 1;
+		}
+		if(!w->dead){
+			alive++;
+		}
+	}
+	return alive;
+}
+
+/**
+ * @brief Reports the jobs left behind by a dead worker, one at a time.
+ * Results the worker published before dying are returned as they are,
+ * the others are reported as failed
+ *
+ * @return 1 if a result was reported, 0 otherwise
+ */
+static int farm_take_dead(struct farm *farm, struct argon_farm_result *result, void *buf, size_t buf_size){
+	for(unsigned i=0; i<farm->nworkers; i++){
+		struct farm_worker *w = &farm->workers[i];
+		if(!w->dead || w->inflight == 0){
+			continue;
+		}
+		// the worker might have died before signalling results_ready
+		if(sem_trywait(&w->results) == 0){
+			farm_result_copy(result, buf, buf_size, w);
+			return 1;
+		}
+		// results come back in the order jobs were queued
+		struct farm_job *job = &w->job_ring[w->res_tail % (FARM_DEPTH + 1)];
+		result->id = job->id;
+		result->status = -1;
+		result->size = 0;
+		w->res_tail++;
+		w->inflight--;
+		return 1;
+	}
+	return 0;
+}
+#endif
+
+/**
+ * @brief Retrieves the result of a job.
+ * Jobs queued to a worker that died are reported with status -1
+ *
+ * @param[out] result id, status and size of the output
+ * @param buf receives the assembled bytes
+ * @param buf_size size of buf. the output is truncated to this size
+ * @param wait if non zero, block until a result is available
+ * @return 1 if a result was collected, 0 if none is available,
+ *   -1 on error or if all the workers are gone
+ */
+int argon_farm_collect(struct argon_farm_result *result, void *buf, size_t buf_size, int wait){
+#ifdef WIN32
+	(void)result;
+	(void)buf;
+	(void)buf_size;
+	(void)wait;
+	return -1;
+#else
+	struct farm *farm = g_farm;
+	if(farm == NULL){
+		return -1;
+	}
+
+	for(;;){
+		if(sem_trywait(&farm->results_ready) == 0){
+			return farm_take_result(farm, result, buf, buf_size);
+		}
+		if(errno != EAGAIN){
+			return -1;
+		}
+
+		int alive = farm_reap(farm);
+		/**
+		 * a worker reaped just now could have signalled a result
+		 * after the check above: take it the normal way
+		 */
+		if(sem_trywait(&farm->results_ready) == 0){
+			return farm_take_result(farm, result, buf, buf_size);
+		}
+		int rc = farm_take_dead(farm, result, buf, buf_size);
+		if(rc != 0){
+			return rc;
+		}
+		if(!wait){
+			return 0;
+		}
+		if(!alive){
+			// nobody left to produce a result
+			return -1;
+		}
+
+		if(sem_timedwait_ms(&farm->results_ready, FARM_POLL_MS) == 0){
+			return farm_take_result(farm, result, buf, buf_size);
+		}
+		if(errno != ETIMEDOUT){
+			return -1;
+		}
+	}
+#endif
+}
+/**
+ * @brief Stops the workers and waits for them to exit.
+ * Pending jobs are processed first
+ */
+void argon_farm_stop(){
+#ifndef WIN32
+	struct farm *farm = g_farm;
+	if(farm == NULL){
+		return;
+	}
+
+	for(unsigned i=0; i<farm->nworkers; i++){
+		if(!farm->workers[i].dead){
+			farm_worker_stop(&farm->workers[i]);
+		}
+	}
+	for(unsigned i=0; i<farm->nworkers; i++){
+		struct farm_worker *w = &farm->workers[i];
+		if(!w->dead){
+			waitpid(w->pid, NULL, 0);
+		}
+		sem_destroy(&w->jobs);
+		sem_destroy(&w->results);
+	}
+	sem_destroy(&farm->results_ready);
+
+	munmap(farm, g_farm_size);
+	g_farm = NULL;
+	g_farm_size = 0;
+#endif
+}
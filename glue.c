@@ -93,11 +93,82 @@ argon_po_entry_find (const char *poc_name){
   return entry != NULL ? entry->pop : NULL;
 }
 
+/**
+ * options and pseudo ops applied after the last full init,
+ * replayed when ARGON_SKIP_INIT has to do a full init instead
+ */
+struct option_log_entry {
+	int pseudo;
+	char *name;
+	char *value;
+};
+static struct option_log_entry *option_log = NULL;
+static size_t option_log_num = 0;
+static size_t option_log_alloc = 0;
+static int option_log_on = 0;
+
+static void option_log_add(int pseudo, const char *name, const char *value){
+	if(!option_log_on){
+		return;
+	}
+	if(option_log_num == option_log_alloc){
+		size_t n = option_log_alloc ? option_log_alloc * 2 : 8;
+		struct option_log_entry *p = argon_malloc(n * sizeof(*p));
+		if(option_log != NULL){
+			memcpy(p, option_log, option_log_num * sizeof(*p));
+			argon_free(option_log);
+		}
+		option_log = p;
+		option_log_alloc = n;
+	}
+	struct option_log_entry *e = &option_log[option_log_num++];
+	e->pseudo = pseudo;
+	e->name = argon_strdup(name);
+	e->value = value ? argon_strdup(value) : NULL;
+}
+
+/**
+ * @brief Empties the option log and starts recording.
+ * Called at the end of a full init, after the default options
+ */
+void argon_option_log_start(){
+	for(size_t i = 0; i < option_log_num; i++){
+		argon_free(option_log[i].name);
+		if(option_log[i].value != NULL){
+			argon_free(option_log[i].value);
+		}
+	}
+	option_log_num = 0;
+	option_log_on = 1;
+}
+
+/**
+ * @brief Applies the recorded options again, after a full init
+ * that stands in for a warm reset. The log is kept as is
+ */
+void argon_option_log_replay(){
+	option_log_on = 0;
+	for(size_t i = 0; i < option_log_num; i++){
+		struct option_log_entry *e = &option_log[i];
+		if(e->pseudo){
+			argon_call_pseudo(e->name, e->value);
+		} else {
+			argon_set_option(e->name, e->value);
+		}
+	}
+	option_log_on = 1;
+}
+
 int argon_call_pseudo(const char *op, char *args){
 	const pseudo_typeS *entry = argon_po_entry_find(op);
 	if(entry == NULL){
 		return -1;
 	}
+	// tc handlers may use the opcode tables
+	argon_md_begin();
+
+	argon_cache_options_update(op, args);
+	option_log_add(1, op, args);
 
 	char *args_copy = NULL;
 
@@ -119,8 +190,258 @@ int argon_call_pseudo(const char *op, char *args){
 	return 0;
 }
 
-void _argon_init_gas(unsigned flags){
+/**
+ * @brief Empties a hash table, keeping its bucket storage
+ */
+void argon_clear_htab(void *htab){
+	htab_t table = (htab_t)htab;
+	// n_elements includes the deleted entries
+	if(table->n_elements == 0){
+		return;
+	}
+	htab_empty(table);
+}
+
+/**
+ * the symbol table is created once, in the init pool, and emptied
+ * in place by the next symbol_begin calls.
+ * it's recognized by the htab_create_alloc call made by symbol_begin
+ */
+static htab_t kept_sy_hash = NULL;
+// number of buckets the table was created with
+static size_t kept_sy_size = 0;
+static int in_symbol_begin = 0;
+
+static void *init_pool_calloc(size_t nmemb, size_t size){
+	// the init pool might already be selected (e.g. md_begin defines symbols)
+	int pool = argon_gcpool_get();
+	argon_gcpool_set(ARGON_POOL_INIT);
+	void *mem = calloc(nmemb, size);
+	argon_gcpool_set(pool);
+	return mem;
+}
+
+extern htab_t __real_htab_create_alloc(size_t size, htab_hash hash_f, htab_eq eq_f,
+	htab_del del_f, htab_alloc alloc_f, htab_free free_f);
+htab_t __wrap_htab_create_alloc(size_t size, htab_hash hash_f, htab_eq eq_f,
+	htab_del del_f, htab_alloc alloc_f, htab_free free_f
+){
+	if(!in_symbol_begin){
+		return __real_htab_create_alloc(size, hash_f, eq_f, del_f, alloc_f, free_f);
+	}
+	if(kept_sy_hash != NULL && htab_size(kept_sy_hash) > kept_sy_size){
+		/**
+		 * grown by a large batch or stream: emptying it would clear
+		 * the whole bucket array on every line, start small again instead
+		 */
+		htab_delete(kept_sy_hash);
+		kept_sy_hash = NULL;
+	}
+	if(kept_sy_hash == NULL){
+		// buckets allocated when the table grows go to the init pool as well
+		kept_sy_hash = __real_htab_create_alloc(size, hash_f, eq_f, del_f, init_pool_calloc, free_f);
+		kept_sy_size = (kept_sy_hash != NULL) ? htab_size(kept_sy_hash) : 0;
+	} else {
+		argon_clear_htab(kept_sy_hash);
+	}
+	return kept_sy_hash;
+}
+
+static void argon_symbol_begin(){
+	in_symbol_begin = 1;
 	symbol_begin();
+	in_symbol_begin = 0;
+}
+
+/**
+ * chunks of the notes and cond_obstack obstacks, begun by the warm resets.
+ * they're allocated in the init pool and kept in a free list when
+ * the obstacks are reset, so that the steady state makes no chunk allocations
+ */
+struct obstack_chunk_hdr {
+	struct obstack_chunk_hdr *next;
+	size_t size;
+};
+
+/**
+ * chunks of the default size, the only ones kept for reuse.
+ * larger chunks (for big objects) are given back to the allocator,
+ * so the list never holds more chunks than were in use at once
+ */
+static struct obstack_chunk_hdr *chunk_free_list = NULL;
+// chunks requested to the allocator (not served by the free list)
+static size_t chunk_allocs = 0;
+// notes and cond_obstack have been begun with obstack_chunk_get
+static int obstacks_recycled = 0;
+
+static void *obstack_chunk_get(size_t size){
+	if(chunk_free_list != NULL && chunk_free_list->size == size){
+		struct obstack_chunk_hdr *hdr = chunk_free_list;
+		chunk_free_list = hdr->next;
+		return hdr + 1;
+	}
+
+	// keep the pool of the caller (e.g. a lazy argon_md_begin runs in the init pool)
+	int pool = argon_gcpool_get();
+	argon_gcpool_set(ARGON_POOL_INIT);
+	struct obstack_chunk_hdr *hdr = malloc(sizeof(*hdr) + size);
+	argon_gcpool_set(pool);
+	if(hdr == NULL){
+		return NULL;
+	}
+	hdr->size = size;
+	chunk_allocs++;
+	return hdr + 1;
+}
+
+static void obstack_chunk_put(void *chunk){
+	struct obstack_chunk_hdr *hdr = (struct obstack_chunk_hdr *)chunk - 1;
+	// notes and cond_obstack are begun with the same chunk size
+	if(hdr->size != notes.chunk_size){
+		free(hdr);
+		return;
+	}
+	hdr->next = chunk_free_list;
+	chunk_free_list = hdr;
+}
+
+/**
+ * @brief Returns the number of obstack chunks allocated for notes and cond_obstack
+ * (free list misses) since the last full reset
+ */
+size_t argon_obstack_chunk_allocs(){
+	return chunk_allocs;
+}
+
+static void obstacks_recycle(){
+	if(obstacks_recycled){
+		obstack_free (&notes, NULL);
+		obstack_free (&cond_obstack, NULL);
+		obstacks_recycled = 0;
+	}
+}
+
+/**
+ * ARGON_HOT_RESET: the output BFD and its sections are kept between resets.
+ * the BFD and the default sections are allocated in the init pool,
+ * and everything BFD allocates past hot.mark (symbols, per-line data)
+ * is released before the live pool is collected.
+ * a line that adds sections can't be undone, and gets a regular reset
+ */
+#define HOT_MAX_SECTIONS 16
+
+struct hot_section {
+	asection *sec;
+	asection saved;
+	asymbol saved_symbol;
+};
+
+static struct {
+	bfd *abfd;
+	void *mark;
+	unsigned nsections;
+	struct hot_section sections[HOT_MAX_SECTIONS];
+} hot;
+
+/**
+ * @brief Opens the output BFD for hot resets
+ */
+bfd *argon_hot_openw(){
+	hot.abfd = NULL;
+	hot.nsections = 0;
+
+	argon_gcpool_set(ARGON_POOL_INIT);
+	bfd *abfd = bfd_openw("dummy", "default");
+	if(abfd != NULL){
+		// created by _argon_init_gas, in the same order
+		bfd_make_section_old_way(abfd, DATA_SECTION_NAME);
+		bfd_make_section_old_way(abfd, BSS_SECTION_NAME);
+		bfd_make_section_old_way(abfd, "*GAS `reg' section*");
+		bfd_make_section_old_way(abfd, "*GAS `expr' section*");
+		bfd_make_section_old_way(abfd, TEXT_SECTION_NAME);
+		hot.mark = bfd_alloc(abfd, 1);
+	}
+	argon_gcpool_set(ARGON_POOL_LIVE);
+
+	if(abfd != NULL && hot.mark != NULL){
+		hot.abfd = abfd;
+	}
+	return abfd;
+}
+
+/**
+ * @brief Saves the sections as they are right after initialization
+ */
+static void hot_snapshot(){
+	unsigned n = 0;
+	for(asection *sec = stdoutput->sections; sec != NULL; sec = sec->next){
+		if(n >= HOT_MAX_SECTIONS){
+			hot.abfd = NULL;
+			return;
+		}
+		struct hot_section *hs = &hot.sections[n++];
+		hs->sec = sec;
+		hs->saved = *sec;
+		hs->saved_symbol = *sec->symbol;
+	}
+	hot.nsections = n;
+}
+
+static void reset_gas_state(unsigned flags);
+
+/**
+ * @brief Rewinds GAS and the output BFD to the state saved by hot_snapshot,
+ * without closing the BFD. _argon_init_gas must be called afterwards
+ *
+ * @return 0 on success, -1 if a regular reset is needed
+ */
+int argon_hot_reset(unsigned flags){
+	if(!HAS_FLAG(flags, ARGON_HOT_RESET)
+	|| !HAS_FLAG(flags, ARGON_KEEP_BUFFER)
+	|| !HAS_FLAG(flags, ARGON_SKIP_INIT)
+	|| HAS_FLAG(flags, ARGON_RESET_FULL)
+	|| HAS_FLAG(flags, ARGON_OBJECT_OUTPUT)
+	|| stdoutput == NULL
+	|| stdoutput != hot.abfd
+	|| stdoutput->section_count != hot.nsections
+	){
+		return -1;
+	}
+
+	asection *sec = stdoutput->sections;
+	for(unsigned i=0; i<hot.nsections; i++, sec = sec->next){
+		if(sec != hot.sections[i].sec){
+			return -1;
+		}
+	}
+	if(sec != NULL){
+		return -1;
+	}
+
+	// must come before the GC, which would free the chunks under BFD
+	bfd_release(stdoutput, hot.mark);
+	// reuses the space just released
+	hot.mark = bfd_alloc(stdoutput, 1);
+	if(hot.mark == NULL){
+		hot.abfd = NULL;
+	}
+
+	reset_gas_state(flags);
+
+	for(unsigned i=0; i<hot.nsections; i++){
+		struct hot_section *hs = &hot.sections[i];
+		*hs->sec = hs->saved;
+		*hs->sec->symbol = hs->saved_symbol;
+		// the segment info is rebuilt by subseg_new
+		bfd_set_section_userdata(hs->sec, NULL);
+	}
+	// or sections couldn't be resized
+	stdoutput->output_has_begun = 0;
+	return 0;
+}
+
+void _argon_init_gas(unsigned flags){
+	argon_symbol_begin();
 	subsegs_begin();
 	
 	if(!HAS_FLAG(flags, ARGON_SKIP_INIT)){
@@ -133,10 +454,10 @@ void _argon_init_gas(unsigned flags){
 			argon_gcpool_set(ARGON_POOL_LIVE);
 		}
 	} else {
-		obstack_free (&notes, NULL);
-		obstack_free (&cond_obstack, NULL);
-		obstack_begin (&notes, chunksize);
-		obstack_begin (&cond_obstack, chunksize);
+		obstacks_recycle();
+		obstack_specify_allocation (&notes, chunksize, 0, obstack_chunk_get, obstack_chunk_put);
+		obstack_specify_allocation (&cond_obstack, chunksize, 0, obstack_chunk_get, obstack_chunk_put);
+		obstacks_recycled = 1;
 	}
 	expr_begin();
 
@@ -175,26 +496,65 @@ void _argon_init_gas(unsigned flags){
 	bfd_set_section_alignment(text_section, 0);
 
 
-	// set fake output_elf_obj_tdata
-	fake_tdata.o = argon_gczalloc(sizeof(struct output_elf_obj_tdata));
+	// objects have the real ELF data
+	if(!HAS_FLAG(flags, ARGON_OBJECT_OUTPUT)){
+		// set fake output_elf_obj_tdata
+		fake_tdata.o = argon_gczalloc(sizeof(struct output_elf_obj_tdata));
 
-	// set fake ELF data
-	elf_tdata(stdoutput) = &fake_tdata;
+		// set fake ELF data
+		elf_tdata(stdoutput) = &fake_tdata;
+	}
 
 	fake_line_buffer = argon_gczalloc(32);
+
+	if(HAS_FLAG(flags, ARGON_HOT_RESET)
+	&& stdoutput == hot.abfd
+	&& hot.nsections == 0
+	){
+		hot_snapshot();
+	}
 }
 
-void argon_reset_gas(unsigned flags){
+/**
+ * @brief argon_reset_gas, without saving the cache file on full resets
+ * (save_cache = 0) when the full reset stands in for a warm one
+ */
+void _argon_reset_gas(unsigned flags, int save_cache){
+	if(HAS_FLAG(flags, ARGON_RESET_FULL) && save_cache){
+		// keep the lines assembled so far for the next runs
+		const char *cache_path = getenv(ARGON_CACHE_FILE_ENV);
+		if(cache_path != NULL && argon_cache_dirty(0)){
+			argon_cache_file_save(cache_path);
+		}
+	}
+
 	if(stdoutput != NULL){
 		bfd_close(stdoutput);
 		stdoutput = NULL;
 		bfd_cache_close_all();
 	}
+	hot.abfd = NULL;
+	hot.nsections = 0;
+
+	reset_gas_state(flags);
+}
+
+void argon_reset_gas(unsigned flags){
+	_argon_reset_gas(flags, 1);
+}
+
+static void reset_gas_state(unsigned flags){
+	// back to the free list, before the structs are cleared
+	obstacks_recycle();
 
 	if(!HAS_FLAG(flags, ARGON_SKIP_GC)){	
 		int pools_to_clear = ARGON_POOL_LIVE;
 		if(HAS_FLAG(flags, ARGON_RESET_FULL)){
 			pools_to_clear |= ARGON_POOL_INIT;
+			// lived in the init pool
+			kept_sy_hash = NULL;
+			chunk_free_list = NULL;
+			chunk_allocs = 0;
 		}
 		argon_malloc_gc(pools_to_clear);
 	}
@@ -233,6 +593,97 @@ void argon_reset_gas(unsigned flags){
 	fake_line_buffer = NULL;
 }
 
+#ifdef TC_GENERIC_RELAX_TABLE
+#ifdef TC_I386
+// relax states of tc-i386.c are (type << 2) | size, with the jumps first
+#define RELAX_STATE_IS_BRANCH(state) (((state) >> 2) <= 2)
+#else
+#define RELAX_STATE_IS_BRANCH(state) 1
+#endif
+#endif
+
+// ARGON_FIXED_SIZE
+static int fixed_size = 0;
+
+void argon_set_fixed_size(int enable){
+	fixed_size = enable;
+	if(enable){
+		// the encodings differ
+		argon_cache_options_update("argon-fixed-size", NULL);
+	}
+}
+
+/**
+ * @brief Gets the size of the variable part of a frag in fixed size mode
+ * 
+ * @return the size, or -1 if it's up to relaxation
+ */
+int argon_frag_fixed_var(fragS *fragP){
+#ifdef TC_GENERIC_RELAX_TABLE
+	if(!fixed_size
+	|| fragP->fr_type != rs_machine_dependent
+	|| !RELAX_STATE_IS_BRANCH(fragP->fr_subtype)
+	){
+		return -1;
+	}
+	const relax_typeS *table = TC_GENERIC_RELAX_TABLE;
+	relax_substateT state = fragP->fr_subtype;
+	while(table[state].rlx_more != 0){
+		state = table[state].rlx_more;
+	}
+	return table[state].rlx_length;
+#else
+	(void)fragP;
+	return -1;
+#endif
+}
+
+/**
+ * @brief Gets the size of the variable part of a frag before relaxation,
+ * i.e. the length of its current (shortest) relax state
+ * 
+ * @return the size, or -1 if the target doesn't use the generic relax table
+ */
+int argon_frag_min_var(fragS *fragP){
+#ifdef TC_GENERIC_RELAX_TABLE
+	if(fragP->fr_type != rs_machine_dependent){
+		return -1;
+	}
+	if(!RELAX_STATE_IS_BRANCH(fragP->fr_subtype)){
+		// padding frags (e.g. -malign-branch) aren't in the table, and start empty
+		return 0;
+	}
+	const relax_typeS *table = TC_GENERIC_RELAX_TABLE;
+	return table[fragP->fr_subtype].rlx_length;
+#else
+	(void)fragP;
+	return -1;
+#endif
+}
+
+extern int __real_md_estimate_size_before_relax(fragS *fragP, segT segment);
+/**
+ * in fixed size mode, relaxable frags are moved to their last relax state
+ * before relaxation starts. relaxation never shrinks frags, so
+ * the sizes don't depend on the distance to the targets
+ * and the relax loop ends after the first pass
+ */
+int __wrap_md_estimate_size_before_relax(fragS *fragP, segT segment){
+	int size = __real_md_estimate_size_before_relax(fragP, segment);
+#ifdef TC_GENERIC_RELAX_TABLE
+	// frags that were already converted are rs_fill now
+	int fixed_var = argon_frag_fixed_var(fragP);
+	if(fixed_var >= 0){
+		const relax_typeS *table = TC_GENERIC_RELAX_TABLE;
+		while(table[fragP->fr_subtype].rlx_more != 0){
+			fragP->fr_subtype = table[fragP->fr_subtype].rlx_more;
+		}
+		size = fixed_var;
+	}
+#endif
+	return size;
+}
+
 int argon_set_option(const char *optname, const char *value){
 	for(struct option *p = md_longopts
 		;p->name != NULL
@@ -242,6 +693,8 @@ int argon_set_option(const char *optname, const char *value){
 			if(p->has_arg && value == NULL) {
 				return -1;
 			}
+			argon_cache_options_update(optname, value);
+			option_log_add(0, optname, value);
 			md_parse_option(p->val, value);
 			return 0;
 		}
@@ -0,0 +1,340 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * 
+ * @file loader.c
+ * @author Stefano Moioli <smxdev4@gmail.com>
+ * @brief Loads independent copies of libgas in the same process
+ * @version 0.1
+ * @date 2026-10-17
+ * 
+ * @copyright Copyright (c) Stefano Moioli 2022
+ * 
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <pthread.h>
+
+#include "loader.h"
+
+/**
+ * GAS keeps its state in globals, so two threads can only assemble
+ * concurrently if each one has its own copy of the library.
+ * 
+ * on glibc every instance gets a new link-map namespace (dlmopen),
+ * otherwise a private copy of the file is loaded.
+ * NOTE: glibc supports at most 16 namespaces, including the main one
+ */
+#if defined(__GLIBC__) && defined(LM_ID_NEWLM)
+#define HAVE_DLMOPEN
+#endif
+
+// a unique address per thread, used to tell owners apart
+static __thread char thread_token;
+static __thread struct argon_instance *thread_instance = NULL;
+
+#ifdef WIN32
+static libhandle_t lib_open_copy(const char *path){
+	char tmp_dir[MAX_PATH + 1];
+	char tmp_path[MAX_PATH + 1];
+	if(GetTempPathA(sizeof(tmp_dir), tmp_dir) == 0
+	|| GetTempFileNameA(tmp_dir, "gas", 0, tmp_path) == 0
+	){
+		return NULL;
+	}
+	if(!CopyFileA(path, tmp_path, FALSE)){
+		DeleteFileA(tmp_path);
+		return NULL;
+	}
+	// the copy can't be deleted while it's loaded
+	return LoadLibraryA(tmp_path);
+}
+#else
+static libhandle_t lib_open_copy(const char *path){
+	const char *tmp_dir = getenv("TMPDIR");
+	if(tmp_dir == NULL){
+		tmp_dir = "/tmp";
+	}
+
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s/libgas-XXXXXX", tmp_dir);
+
+	int out = mkstemp(tmp_path);
+	if(out < 0){
+		return NULL;
+	}
+	int in = open(path, O_RDONLY);
+	if(in < 0){
+		close(out);
+		unlink(tmp_path);
+		return NULL;
+	}
+
+	char buf[64 * 1024];
+	ssize_t n;
+	while((n = read(in, buf, sizeof(buf))) > 0){
+		if(write(out, buf, n) != n){
+			n = -1;
+			break;
+		}
+	}
+	close(in);
+	close(out);
+
+	libhandle_t handle = NULL;
+	if(n == 0){
+		handle = dlopen(tmp_path, RTLD_NOW | RTLD_LOCAL);
+	}
+	// the mapping stays valid
+	unlink(tmp_path);
+	return handle;
+}
+#endif
+
+static libhandle_t lib_open_instance(const char *path, unsigned flags){
+#ifdef HAVE_DLMOPEN
+	if(!HAS_FLAG(flags, ARGON_LOAD_COPY)){
+		return dlmopen(LM_ID_NEWLM, path, RTLD_NOW | RTLD_LOCAL);
+	}
+#else
+	(void)flags;
+#endif
+	return lib_open_copy(path);
+}
+
+/**
+ * @brief Loads a new, independent instance of libgas
+ * and resolves its import table
+ * 
+ * @param path path of libgas
+ * @param flags see argon_load_flags
+ * @return struct argon_instance* or NULL on failure
+ */
+struct argon_instance *argon_instance_open(const char *path, unsigned flags){
+	struct argon_instance *inst = calloc(1, sizeof(*inst));
+	if(inst == NULL){
+		return NULL;
+	}
+
+	inst->handle = lib_open_instance(path, flags);
+	if(inst->handle == NULL){
+		LIB_PERROR(stderr);
+		free(inst);
+		return NULL;
+	}
+
+#define resolveSymbol(sym) LIB_GETSYM(inst->handle, sym)
+#define BINUTILS_IMPORT_INSTANCE inst
+#include "binutils_imports.h"
+#undef BINUTILS_IMPORT_INSTANCE
+#undef resolveSymbol
+
+	return inst;
+}
+
+void argon_instance_close(struct argon_instance *inst){
+	if(inst == NULL){
+		return;
+	}
+	if(thread_instance == inst){
+		thread_instance = NULL;
+	}
+	LIB_CLOSE(inst->handle);
+	free(inst);
+}
+
+/**
+ * @brief Pins the instance to the calling thread
+ * 
+ * @return 0 on success, -1 if the instance is owned by another thread
+ */
+int argon_instance_bind(struct argon_instance *inst){
+	void *self = &thread_token;
+	void *expected = NULL;
+	if(!__atomic_compare_exchange_n(&inst->owner, &expected, self,
+		0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+	&& expected != self
+	){
+		return -1;
+	}
+	thread_instance = inst;
+	return 0;
+}
+
+/**
+ * @brief Releases the instance, so that another thread can bind it
+ */
+void argon_instance_unbind(struct argon_instance *inst){
+	void *self = &thread_token;
+	if(__atomic_compare_exchange_n(&inst->owner, &self, NULL,
+		0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+	&& thread_instance == inst
+	){
+		thread_instance = NULL;
+	}
+}
+
+/**
+ * @brief Returns the instance bound to the calling thread, or NULL
+ */
+struct argon_instance *argon_instance_current(){
+	return thread_instance;
+}
+
+struct argon_registry_entry {
+	char arch[32];
+	struct argon_instance *inst;
+	// serializes the users of the instance
+	pthread_mutex_t lock;
+	// output buffer of the instance
+	uint8_t *mem;
+};
+
+struct argon_registry {
+	size_t buffer_size;
+	unsigned count;
+	struct argon_registry_entry entries[ARGON_REGISTRY_MAX];
+};
+
+/**
+ * @brief Creates an empty registry
+ * 
+ * @param buffer_size size of the output buffer of each instance
+ */
+struct argon_registry *argon_registry_new(size_t buffer_size){
+	struct argon_registry *reg = calloc(1, sizeof(*reg));
+	if(reg == NULL){
+		return NULL;
+	}
+	reg->buffer_size = buffer_size;
+	return reg;
+}
+
+void argon_registry_free(struct argon_registry *reg){
+	if(reg == NULL){
+		return;
+	}
+	for(unsigned i=0; i<reg->count; i++){
+		struct argon_registry_entry *e = &reg->entries[i];
+		struct argon_instance *inst = e->inst;
+		if(argon_instance_bind(inst) == 0){
+			inst->argon_reset_gas(ARGON_RESET_FULL);
+			// allocated by the allocator of the instance namespace
+			inst->argon_free(e->mem);
+			argon_instance_unbind(inst);
+		}
+		argon_instance_close(inst);
+		pthread_mutex_destroy(&e->lock);
+	}
+	free(reg);
+}
+
+static struct argon_registry_entry *registry_entry(struct argon_registry *reg, const char *arch){
+	for(unsigned i=0; i<reg->count; i++){
+		if(!strcmp(reg->entries[i].arch, arch)){
+			return &reg->entries[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Loads and initializes a libgas instance
+ * 
+ * @param arch name used to route requests. if NULL, the name reported
+ *   by the library is used (argon_arch_name)
+ * @param path path of libgas (e.g. libgas-riscv64.so)
+ * @param flags see argon_load_flags
+ * @return 0 on success, -1 on failure
+ */
+int argon_registry_load(struct argon_registry *reg, const char *arch, const char *path, unsigned flags){
+	if(reg->count >= ARGON_REGISTRY_MAX){
+		return -1;
+	}
+
+	struct argon_instance *inst = argon_instance_open(path, flags);
+	if(inst == NULL){
+		return -1;
+	}
+	if(arch == NULL){
+		arch = inst->argon_arch_name();
+	}
+	if(strlen(arch) >= sizeof(reg->entries[0].arch)
+	|| registry_entry(reg, arch) != NULL
+	|| argon_instance_bind(inst) < 0
+	){
+		argon_instance_close(inst);
+		return -1;
+	}
+
+	uint8_t *mem = inst->argon_init_gas(reg->buffer_size,
+		ARGON_RESET_FULL | ARGON_FAST_INIT);
+	argon_instance_unbind(inst);
+	if(mem == NULL){
+		argon_instance_close(inst);
+		return -1;
+	}
+
+	struct argon_registry_entry *e = &reg->entries[reg->count];
+	strcpy(e->arch, arch);
+	e->inst = inst;
+	e->mem = mem;
+	pthread_mutex_init(&e->lock, NULL);
+	reg->count++;
+	return 0;
+}
+
+struct argon_instance *argon_registry_find(struct argon_registry *reg, const char *arch){
+	struct argon_registry_entry *e = registry_entry(reg, arch);
+	return (e != NULL) ? e->inst : NULL;
+}
+
+/**
+ * @brief Assembles a line with the instance registered for arch.
+ * Requests for different architectures can run concurrently
+ * 
+ * @param out receives the assembled bytes
+ * @param out_size size of out. longer output is truncated
+ * @return number of bytes produced (can be more than out_size),
+ *   or -1 if no instance is registered for arch
+ *   or if the instance is bound to another thread
+ */
+long argon_registry_assemble(struct argon_registry *reg, const char *arch, const char *line, void *out, size_t out_size){
+	struct argon_registry_entry *e = registry_entry(reg, arch);
+	if(e == NULL){
+		return -1;
+	}
+
+	pthread_mutex_lock(&e->lock);
+	struct argon_instance *inst = e->inst;
+	if(argon_instance_bind(inst) < 0){
+		// bound by a thread that got it from argon_registry_find
+		pthread_mutex_unlock(&e->lock);
+		return -1;
+	}
+	{
+		inst->argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+		inst->argon_fseek(0, SEEK_SET);
+		inst->argon_assemble(line);
+	}
+	size_t written = inst->argon_bfd_data_written();
+	memcpy(out, e->mem, (written < out_size) ? written : out_size);
+	argon_instance_unbind(inst);
+	pthread_mutex_unlock(&e->lock);
+
+	return (long)written;
+}
@@ -0,0 +1,77 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * 
+ * @file loader.h
+ * @author Stefano Moioli <smxdev4@gmail.com>
+ * @brief Loads independent copies of libgas in the same process
+ * @version 0.1
+ * @date 2026-10-17
+ * 
+ * @copyright Copyright (c) Stefano Moioli 2022
+ * 
+ */
+#ifndef __ARGON_LOADER_H
+#define __ARGON_LOADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "argon.h"
+#include "support.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum argon_load_flags {
+	/**
+	 * load a private copy of the library file
+	 * instead of a new link-map namespace (dlmopen).
+	 * always used where dlmopen isn't available
+	 */
+	ARGON_LOAD_COPY = 1 << 0
+};
+
+/**
+ * a libgas instance, with its own GAS globals and import table.
+ * an instance must only be used by the thread it's bound to
+ */
+struct argon_instance {
+	libhandle_t handle;
+	// token of the owning thread (see argon_instance_bind)
+	void *owner;
+
+#define BINUTILS_IMPORT_STRUCT
+#include "binutils_imports.h"
+#undef BINUTILS_IMPORT_STRUCT
+};
+
+struct argon_instance *argon_instance_open(const char *path, unsigned flags);
+void argon_instance_close(struct argon_instance *inst);
+
+int argon_instance_bind(struct argon_instance *inst);
+void argon_instance_unbind(struct argon_instance *inst);
+struct argon_instance *argon_instance_current();
+
+/**
+ * a set of libgas instances, one per architecture,
+ * loaded side by side and looked up by name.
+ * glibc has 16 link namespaces and the program uses the first one,
+ * so at most 15 instances can be opened with dlmopen
+ */
+#define ARGON_REGISTRY_MAX 15
+
+struct argon_registry;
+
+struct argon_registry *argon_registry_new(size_t buffer_size);
+void argon_registry_free(struct argon_registry *reg);
+
+int argon_registry_load(struct argon_registry *reg, const char *arch, const char *path, unsigned flags);
+struct argon_instance *argon_registry_find(struct argon_registry *reg, const char *arch);
+long argon_registry_assemble(struct argon_registry *reg, const char *arch, const char *line, void *out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * @file object.c
+ * @author Stefano Moioli <smxdev4@gmail.com>
+ * @brief Relocatable ELF objects, written to memory
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) Stefano Moioli 2022
+ */
+#include "as.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bfd.h"
+
+#include "argon.h"
+#include "argon_api.h"
+
+/**
+ * with ARGON_OBJECT_OUTPUT, the output BFD is a real ELF object
+ * (symbols, relocations, every section) written to a buffer
+ * instead of a file. BFD only writes the object when it's closed,
+ * so there must be a single write_object_file per object:
+ * assemble with argon_assemble_batch/argon_assemble_buffer
+ * (or argon_assemble_object), not line by line
+ */
+
+// name of the in-memory source, as seen by GAS
+#define OBJECT_FILE_NAME "{argon object}"
+
+extern uint8_t *argon_init_gas(size_t bufferSize, unsigned flags);
+extern void *argon_bfd_object_take(size_t *size);
+extern bool is_object_bfd(void *abfd);
+
+/**
+ * @brief Closes the output BFD, and hands the object over to the caller.
+ * GAS must be initialized again (argon_init_gas) before assembling more
+ *
+ * @param[out] object receives the object, to be released with argon_free
+ * @param[out] size size of the object
+ * @return 0 on success,
+ *   -1 on failure or if GAS wasn't initialized with ARGON_OBJECT_OUTPUT
+ */
+int argon_object_finish(void **object, size_t *size){
+	*object = NULL;
+	*size = 0;
+	if(stdoutput == NULL){
+		return -1;
+	}
+	if(!is_object_bfd(stdoutput)){
+		// not opened with ARGON_OBJECT_OUTPUT: closing it would write nothing we can take
+		return -1;
+	}
+
+	// writes the headers, the symbol table and the relocations
+	int rc = bfd_close(stdoutput) ? 0 : -1;
+	stdoutput = NULL;
+
+	size_t object_size;
+	void *data = argon_bfd_object_take(&object_size);
+	if(rc < 0 || data == NULL){
+		argon_free(data);
+		return -1;
+	}
+	*object = data;
+	*size = object_size;
+	return 0;
+}
+
+/**
+ * @brief Assembles a source into a relocatable ELF object, in memory.
+ * The source goes through the GAS reader, so directives, labels
+ * and macros work as with the real assembler.
+ * GAS must be fully initialized. The output buffer isn't touched
+ *
+ * .cfi directives aren't supported (no .eh_frame is written)
+ *
+ * @param text source text, not necessarily NUL terminated
+ * @param size size of text
+ * @param[out] object receives the object, to be released with argon_free
+ * @param[out] object_size size of the object
+ * @return 0 on success, -1 if GAS reported errors or on failure
+ */
+int argon_assemble_object(const char *text, size_t size, void **object, size_t *object_size){
+	*object = NULL;
+	*object_size = 0;
+#ifdef WIN32
+	(void)text;
+	(void)size;
+	fputs("argon_assemble_object: fmemopen() not supported on Windows\n", stderr);
+	return -1;
+#else
+	argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT | ARGON_OBJECT_OUTPUT);
+	if(stdoutput == NULL){
+		return -1;
+	}
+
+	int errors = had_errors();
+
+	argon_md_begin();
+	argon_stream_source_set(OBJECT_FILE_NAME, text, size);
+	input_scrub_begin();
+	read_a_source_file(OBJECT_FILE_NAME);
+	input_scrub_end();
+	argon_stream_source_set(NULL, NULL, 0);
+
+	argon_bfd_data_begin();
+	write_object_file();
+
+	int rc = (had_errors() > errors) ? -1 : 0;
+	void *data;
+	size_t data_size;
+	if(argon_object_finish(&data, &data_size) < 0){
+		return -1;
+	}
+	if(rc < 0){
+		argon_free(data);
+		return -1;
+	}
+	*object = data;
+	*object_size = data_size;
+	return 0;
+#endif
+}
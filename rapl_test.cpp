@@ -33,10 +33,12 @@
 
 #include "argon.h"
 #include "support.h"
+#include "loader.h"
 
 #define UNUSED(x) ((void)(x))
 
 libhandle_t gas = (libhandle_t)0;
+static const char *gas_path = NULL;
 
 #ifdef __cplusplus
 template<typename T>
@@ -127,14 +129,334 @@ static inline long timer_end(struct timespec start_time){
 }
 
 //#define PERF
-#ifdef PERF
+// restore a checkpoint instead of resetting GAS between operations
+//#define PERF_CHECKPOINT
+// keep the output BFD open between operations (ARGON_HOT_RESET)
+//#define PERF_HOT_RESET
+// dispatch to a pool of forked workers, one per CPU
+//#define PERF_FARM
+// assemble from several threads, each with its own libgas instance
+//#define PERF_INSTANCES
+// compare line by line assembly with argon_assemble_batch
+//#define PERF_BATCH
+// serve repeated lines from the line cache
+//#define PERF_CACHE
+// report the obstack chunks allocated each second (0 in the steady state)
+//#define PERF_OBSTACK
+// compare assembly of a line with instantiation of its stencil
+//#define PERF_STENCIL
+// compare warm resets with full inits, on lines of the target architecture
+// (MIPS and Z80 warm resets are full inits; RISC-V and PPC reset in place with ARGON_WARM_RESET=1)
+//#define PERF_ARCH
+// time a full init and the first line, with and without ARGON_LAZY_INIT
+// (with PERF_CACHE, the lazy runs are served by the cache and never build the tables)
+//#define PERF_STARTUP
+#if defined(PERF) && defined(PERF_BATCH)
+static const char *perf_batch_lines[] = {
+	"push rbp",
+	"mov rbp, rsp",
+	"mov rax, rdi",
+	"add rax, rsi",
+	"imul rax, rdx",
+	"xor ecx, ecx",
+	"cmp rax, rcx",
+	"jne .",
+	"lea rax, [rax + rcx * 8 + 16]",
+	"pop rbp",
+	"ret"
+};
+#define PERF_BATCH_REPEAT 20
+#define PERF_BATCH_SIZE (PERF_BATCH_REPEAT * (sizeof(perf_batch_lines) / sizeof(perf_batch_lines[0])))
+
+/**
+ * @brief assembles the same function for one second
+ * @return lines per second
+ */
+static long perf_batch_run(const char **lines, size_t n, int batch){
+	size_t offsets[PERF_BATCH_SIZE];
+	double millis = 0;
+	long nlines = 0;
+	while(millis < 1000){
+		struct timespec ts = timer_start();
+		if(batch){
+			argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+			argon_fseek(0, SEEK_SET);
+			argon_assemble_batch(lines, n, offsets);
+		} else {
+			argon_fseek(0, SEEK_SET);
+			for(size_t i=0; i<n; i++){
+				// each write appends to the previous one
+				argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+				argon_assemble(lines[i]);
+			}
+		}
+		millis += timer_end(ts) / 1e6;
+		nlines += n;
+	}
+	return nlines;
+}
+
+void perf(){
+	const char *lines[PERF_BATCH_SIZE];
+	size_t nlines = sizeof(perf_batch_lines) / sizeof(perf_batch_lines[0]);
+	for(size_t i=0; i<PERF_BATCH_SIZE; i++){
+		lines[i] = perf_batch_lines[i % nlines];
+	}
+
+	for(;;){
+		long single = perf_batch_run(lines, PERF_BATCH_SIZE, 0);
+		long batch = perf_batch_run(lines, PERF_BATCH_SIZE, 1);
+		fprintf(stderr, "%ld lines/s (line by line), %ld lines/s (batch of %zu)\n",
+			single, batch, (size_t)PERF_BATCH_SIZE);
+	}
+}
+#elif defined(PERF) && defined(PERF_STENCIL)
+#define PERF_STENCIL_BATCH 1000
+
+void perf(){
+	struct argon_stencil *st = argon_stencil_create("mov rax, offset ${imm}");
+	if(st == NULL){
+		fputs("argon_stencil_create() failed\n", stderr);
+		return;
+	}
+
+	uint8_t out[32];
+	char line[64];
+	for(;;){
+		long assembled = 0;
+		double millis = 0;
+		while(millis < 1000){
+			struct timespec ts = timer_start();
+			snprintf(line, sizeof(line), "mov rax, %ld", assembled);
+			argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+			argon_fseek(0, SEEK_SET);
+			argon_assemble(line);
+			millis += timer_end(ts) / 1e6;
+			assembled++;
+		}
+
+		long instantiated = 0;
+		millis = 0;
+		while(millis < 1000){
+			struct timespec ts = timer_start();
+			for(int i=0; i<PERF_STENCIL_BATCH; i++){
+				uint64_t value = instantiated++;
+				argon_stencil_instantiate(st, out, (uintptr_t)out, &value);
+			}
+			millis += timer_end(ts) / 1e6;
+		}
+		fprintf(stderr, "%ld lines/s (argon_assemble), %ld lines/s (stencil)\n",
+			assembled, instantiated);
+	}
+}
+#elif defined(PERF) && defined(PERF_ARCH)
+struct perf_arch_lines {
+	const char *arch;
+	const char *lines[3];
+};
+
+static const struct perf_arch_lines perf_arch_table[] = {
+	{ "i386", { "mov rax, 1", "add rcx, qword ptr [rsp+8]", "jmp ." } },
+	{ "mips", { "addiu $2, $2, 1", "lw $4, 8($sp)", "jr $31" } },
+	{ "riscv", { "addi a0, a0, 1", "ld a1, 8(sp)", "ret" } },
+	{ "ppc", { "addi 3, 3, 1", "lwz 4, 8(1)", "blr" } },
+	{ "z80", { "ld a, 1", "add a, b", "ret" } }
+};
+
+static long perf_arch_run(const struct perf_arch_lines *t, unsigned flags){
+	long assembled = 0;
+	double millis = 0;
+	while(millis < 1000){
+		struct timespec ts = timer_start();
+		argon_init_gas(0, flags);
+		argon_fseek(0, SEEK_SET);
+		argon_assemble(t->lines[assembled % 3]);
+		millis += timer_end(ts) / 1e6;
+		assembled++;
+	}
+	return assembled;
+}
+
+void perf(){
+	const char *arch = argon_arch_name();
+	const struct perf_arch_lines *t = NULL;
+	for(size_t i=0; i<sizeof(perf_arch_table) / sizeof(perf_arch_table[0]); i++){
+		if(!strcmp(perf_arch_table[i].arch, arch)){
+			t = &perf_arch_table[i];
+			break;
+		}
+	}
+	if(t == NULL){
+		fprintf(stderr, "no sample lines for %s\n", arch);
+		return;
+	}
+
+	for(;;){
+		long warm = perf_arch_run(t, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+		long full = perf_arch_run(t, ARGON_KEEP_BUFFER | ARGON_RESET_FULL | ARGON_FAST_INIT);
+		fprintf(stderr, "%s: %ld lines/s (warm reset), %ld lines/s (full init)\n",
+			arch, warm, full);
+	}
+}
+#elif defined(PERF) && defined(PERF_STARTUP)
+#define PERF_STARTUP_RUNS 100
+
+/**
+ * @return average microseconds of a full init plus the first line
+ * @param[out] init_us average microseconds of the init alone
+ */
+static double perf_startup_run(unsigned flags, double *init_us){
+	double init_total = 0;
+	double total = 0;
+	for(int i=0; i<PERF_STARTUP_RUNS; i++){
+		struct timespec ts = timer_start();
+		argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_RESET_FULL | ARGON_FAST_INIT | flags);
+		double init = timer_end(ts) / 1e3;
+
+		ts = timer_start();
+		argon_fseek(0, SEEK_SET);
+		argon_assemble("jmp .");
+		init_total += init;
+		total += init + timer_end(ts) / 1e3;
+	}
+	*init_us = init_total / PERF_STARTUP_RUNS;
+	return total / PERF_STARTUP_RUNS;
+}
+
+void perf(){
+#ifdef PERF_CACHE
+	argon_cache_init(1024);
+#endif
+	for(;;){
+		double eager_init, lazy_init;
+		double eager = perf_startup_run(0, &eager_init);
+		double lazy = perf_startup_run(ARGON_LAZY_INIT, &lazy_init);
+		fprintf(stderr, "startup: %.1f us (init %.1f us), lazy: %.1f us (init %.1f us)\n",
+			eager, eager_init, lazy, lazy_init);
+	}
+}
+#elif defined(PERF) && defined(PERF_INSTANCES)
+#define PERF_NUM_INSTANCES 4
+
+struct perf_thread {
+	pthread_t thread;
+	struct argon_instance *inst;
+	long opers;
+};
+
+static void *perf_instance_run(void *arg){
+	struct perf_thread *t = (struct perf_thread *)arg;
+	struct argon_instance *inst = t->inst;
+	if(argon_instance_bind(inst) < 0){
+		return NULL;
+	}
+	inst->argon_init_gas(1024, ARGON_RESET_FULL | ARGON_FAST_INIT);
+	for(;;){
+		inst->argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+		inst->argon_fseek(0, SEEK_SET);
+		inst->argon_assemble("jmp .");
+		__atomic_fetch_add(&t->opers, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+void perf(){
+	struct perf_thread threads[PERF_NUM_INSTANCES];
+	memset(threads, 0x00, sizeof(threads));
+
+	for(int i=0; i<PERF_NUM_INSTANCES; i++){
+		threads[i].inst = argon_instance_open(gas_path, 0);
+		if(threads[i].inst == NULL){
+			fprintf(stderr, "argon_instance_open() failed\n");
+			return;
+		}
+		pthread_create(&threads[i].thread, NULL, perf_instance_run, &threads[i]);
+	}
+
+	for(;;){
+		sleep(1);
+		long opers = 0;
+		for(int i=0; i<PERF_NUM_INSTANCES; i++){
+			opers += __atomic_exchange_n(&threads[i].opers, 0, __ATOMIC_RELAXED);
+		}
+		fprintf(stderr, "%ld ops/s (%d instances)\n", opers, PERF_NUM_INSTANCES);
+	}
+}
+#elif defined(PERF) && defined(PERF_FARM)
 void perf(){
+	long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	if(argon_farm_start((nproc > 0) ? nproc : 1) < 0){
+		fputs("argon_farm_start() failed\n", stderr);
+		return;
+	}
+
+	uint8_t out[ARGON_FARM_OUTPUT_MAX];
+	struct argon_farm_result res;
+
 	double millis = 0;
 	long opers = 0;
+	for(;;){
+		struct timespec ts = timer_start();
+		{
+			// keep all workers busy
+			while(argon_farm_submit("jmp .", NULL) == 0);
+			// wait for one result, then drain the ready ones
+			int rc = argon_farm_collect(&res, out, sizeof(out), 1);
+			for(;rc == 1; rc = argon_farm_collect(&res, out, sizeof(out), 0)){
+				++opers;
+			}
+		}
+		long diff = timer_end(ts);
+		double diff_millis = diff / 1e6;
+		millis += diff_millis;
+		if(millis >= 1000){
+			fprintf(stderr, "%ld ops/s\n", opers);
+			millis = 0;
+			opers = 0;
+		}
+	}
+}
+#elif defined(PERF)
+#ifdef PERF_CHECKPOINT
+/**
+ * @brief runs the regular loop (argon_init_gas reset) for one second,
+ * before the checkpoint is made
+ * @return lines per second
+ */
+static long perf_reset_rate(){
+	long opers = 0;
+	double millis = 0;
+	for(;millis < 1000; ++opers){
+		struct timespec ts = timer_start();
+		argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+		argon_fseek(0, SEEK_SET);
+		argon_assemble("jmp .");
+		millis += timer_end(ts) / 1e6;
+	}
+	return opers;
+}
+static long perf_reset_ops = 0;
+#endif
+
+void perf(){
+#ifdef PERF_CACHE
+	argon_cache_init(1024);
+#endif
+	double millis = 0;
+	long opers = 0;
+#ifdef PERF_OBSTACK
+	size_t chunk_allocs = argon_obstack_chunk_allocs();
+#endif
 	for(;;++opers){
 		struct timespec ts = timer_start();
 		{
+		#if defined(PERF_CHECKPOINT)
+			argon_restore();
+		#elif defined(PERF_HOT_RESET)
+			argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT | ARGON_HOT_RESET);
+		#else
 			argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+		#endif
 			argon_fseek(0, SEEK_SET);
 			argon_assemble("jmp .");
 		}
@@ -143,6 +465,25 @@ void perf(){
 		millis += diff_millis;
 		if(millis >= 1000){
 			fprintf(stderr, "%ld ops/s\n", opers);
+		#ifdef PERF_CHECKPOINT
+			// the request targets 10x
+			fprintf(stderr, "checkpoint: %.1fx the argon_init_gas reset (%ld ops/s)\n",
+				(double)opers / perf_reset_ops, perf_reset_ops);
+		#endif
+		#ifdef PERF_CACHE
+			struct argon_cache_stats stats;
+			argon_cache_get_stats(&stats);
+			fprintf(stderr, "cache: %llu hits (%llu from file), %llu misses, %llu bypass\n",
+				(unsigned long long)stats.hits,
+				(unsigned long long)stats.file_hits,
+				(unsigned long long)stats.misses,
+				(unsigned long long)stats.bypass);
+		#endif
+		#ifdef PERF_OBSTACK
+			size_t allocs = argon_obstack_chunk_allocs();
+			fprintf(stderr, "obstack: %zu chunk allocations\n", allocs - chunk_allocs);
+			chunk_allocs = allocs;
+		#endif
 			millis = 0;
 			opers = 0;
 		}
@@ -150,11 +491,66 @@ void perf(){
 }
 #endif
 
+// assemble into a dual mapped code buffer (RW view + RX view)
+//#define RAPL_DUAL_MAP
+#if defined(RAPL_DUAL_MAP) && defined(__linux__)
+#include <sys/mman.h>
+
+static void *dual_map_rx = NULL;
+
+/**
+ * @brief maps the same memory twice, writable and executable
+ * 
+ * @return the RW view, or NULL on failure
+ */
+static uint8_t *dual_map_alloc(size_t size){
+	int fd = memfd_create("argon_code", 0);
+	if(fd < 0){
+		perror("memfd_create");
+		return NULL;
+	}
+	if(ftruncate(fd, size) < 0){
+		perror("ftruncate");
+		close(fd);
+		return NULL;
+	}
+	void *rw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	void *rx = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+	close(fd);
+	if(rw == MAP_FAILED || rx == MAP_FAILED){
+		perror("mmap");
+		return NULL;
+	}
+	dual_map_rx = rx;
+	return (uint8_t *)rw;
+}
+#endif
+
+#ifndef WIN32
+#include <sys/resource.h>
+
+static int on_stream_chunk(const struct argon_stream_chunk *chunk, void *opaque){
+	UNUSED(opaque);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(stderr, "chunk %zu: %zu source bytes -> %zu bytes (status %d), peak RSS %ld KB\n",
+		chunk->index, chunk->source_size, chunk->output_size,
+		chunk->status, usage.ru_maxrss);
+	return 0;
+}
+#endif
+
+static void on_output_overflow(size_t required, size_t size, void *opaque){
+	UNUSED(opaque);
+	fprintf(stderr, "output truncated: %zu bytes required, buffer is %zu bytes\n",
+		required, size);
+}
+
 int main(int argc, char *argv[]){
 	UNUSED(argv);
 
 	if(argc < 2){
-		fprintf(stderr, "Usage: %s ./libgas.so\n", argv[0]);
+		fprintf(stderr, "Usage: %s ./libgas.so [file.s]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
@@ -164,17 +560,50 @@ int main(int argc, char *argv[]){
 	//setvbuf(stdout, NULL, _IONBF, 0);
 	//setvbuf(stderr, NULL, _IONBF, 0);
 
-	gas = LIB_OPEN(argv[1]);
+	gas_path = argv[1];
+	gas = LIB_OPEN(gas_path);
 	if(gas == NULL){
 		LIB_PERROR(stderr);
 		return 1;
 	}
 	#include "binutils_imports.h"
 
-	uint8_t *mem = argon_init_gas(1024 * 1024,
-		ARGON_RESET_FULL | ARGON_FAST_INIT);
+#if defined(RAPL_DUAL_MAP) && defined(__linux__)
+	size_t mem_size = 1024 * 1024;
+	uint8_t *mem = dual_map_alloc(mem_size);
+	if(mem == NULL
+	|| argon_bfd_data_set_buffer(mem, mem_size, dual_map_rx) < 0
+	){
+		return 1;
+	}
+	argon_init_gas(0, ARGON_RESET_FULL | ARGON_FAST_INIT | ARGON_KEEP_BUFFER);
+#else
+	// start small, the buffer grows for larger outputs
+	uint8_t *mem = argon_init_gas(4096,
+		ARGON_RESET_FULL | ARGON_FAST_INIT | ARGON_GROW_BUFFER);
+#endif
+	argon_bfd_data_set_overflow(on_output_overflow, NULL);
+
+#ifndef WIN32
+	if(argc > 2){
+		// stream a source file, chunk by chunk
+		int rc = argon_assemble_file(argv[2], 0, on_stream_chunk, NULL);
+		argon_bfd_data_free();
+		argon_reset_gas(ARGON_RESET_FULL);
+		LIB_CLOSE(gas);
+		return (rc < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+#endif
 
 #ifdef PERF
+#ifdef PERF_CHECKPOINT
+	// reference for the speedup
+	perf_reset_ops = perf_reset_rate();
+	if(argon_checkpoint() < 0){
+		fputs("argon_checkpoint() failed\n", stderr);
+		return 1;
+	}
+#endif
 	perf();
 #else
 	char buffer[128] = {0};
@@ -195,17 +624,57 @@ int main(int argc, char *argv[]){
 		}
 		printf("<= %s\n", buffer);
 		argon_assemble(buffer);
+	#if defined(RAPL_DUAL_MAP) && defined(__linux__)
+		printf("@ %p\n", argon_bfd_data_exec_addr());
+	#endif
+		// the buffer might have moved
+		mem = (uint8_t *)argon_bfd_data_get();
 		size_t written = argon_bfd_data_written();
 		for(size_t i=0; i<written; i++){
 			printf("%02hhx ", mem[i]);
 		}
 		puts("");
 
+		// other sections (.data, .rodata, ...)
+		size_t num_sections = argon_bfd_data_section_count();
+		for(size_t i=0; i<num_sections; i++){
+			struct argon_section sec;
+			if(argon_bfd_data_section_get(i, &sec) < 0
+			|| !strcmp(sec.name, ".text")
+			){
+				continue;
+			}
+			printf("%s: ", sec.name);
+			for(size_t j=0; j<sec.size; j++){
+				printf("%02hhx ", sec.data[j]);
+			}
+			puts("");
+		}
+
+		// unresolved references (e.g. call targets)
+		size_t num_fixups = argon_bfd_data_fixup_count();
+		for(size_t i=0; i<num_fixups; i++){
+			struct argon_fixup fix;
+			if(argon_bfd_data_fixup_get(i, &fix) < 0){
+				continue;
+			}
+			printf("%s+0x%llx: %s %s%+lld (%u bytes)\n",
+				fix.section, (unsigned long long)fix.offset,
+				fix.type_name ? fix.type_name : "?",
+				fix.symbol ? fix.symbol : "",
+				(long long)fix.addend, fix.size);
+		}
+
 		memset(mem, 0x00, written);
 	}
 #endif
 
-	free(mem);
+#if defined(RAPL_DUAL_MAP) && defined(__linux__)
+	munmap(mem, mem_size);
+	munmap(dual_map_rx, mem_size);
+#else
+	argon_bfd_data_free();
+#endif
 	argon_reset_gas(ARGON_RESET_FULL);
 
 	LIB_CLOSE(gas);
@@ -0,0 +1,354 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * @file session.c
+ * @author Stefano Moioli <smxdev4@gmail.com>
+ * @brief Incremental assembly, with labels that persist across calls
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) Stefano Moioli 2022
+ */
+#include "as.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bfd.h"
+
+#include "argon.h"
+#include "argon_api.h"
+
+/**
+ * GAS can't keep frags alive across write_object_file,
+ * so every append is assembled on its own, right after the previous one.
+ * labels defined by an append are recorded by the session.
+ * references to labels GAS doesn't know (defined by earlier appends,
+ * or not defined yet) are left as relocations: the session resolves them
+ * against its labels, and keeps the others pending until the label shows up,
+ * then patches the bytes written by the earlier append.
+ *
+ * references to a label of a previous append always get the
+ * long encoding, since GAS can't know how far the label is.
+ * ".L" labels are local to GAS and can't be referenced by later appends
+ */
+
+extern uint8_t *argon_init_gas(size_t bufferSize, unsigned flags);
+extern void argon_fseek(long offset, int whence);
+extern size_t argon_bfd_data_written();
+extern int argon_assemble_batch(const char **lines, size_t n, size_t *offsets);
+
+extern void *__real_calloc(size_t nmemb, size_t size);
+extern void __real_free(void *ptr);
+
+struct session_label {
+	char *name;
+	// relative to the start of the session
+	size_t offset;
+};
+
+struct session_fixup {
+	char *symbol;
+	const void *howto;
+	// relative to the start of the session
+	size_t offset;
+	int64_t addend;
+};
+
+struct session {
+	int active;
+	// position of the session in the output buffer
+	size_t start;
+	size_t size;
+	htab_t labels;
+	struct session_fixup *pending;
+	size_t npending;
+	size_t pending_capacity;
+};
+
+static struct session g_session ARGON_PERSIST;
+
+static hashval_t session_label_hash(const void *p){
+	const struct session_label *label = p;
+	return htab_hash_string(label->name);
+}
+
+static int session_label_eq(const void *a, const void *b){
+	const struct session_label *la = a;
+	const struct session_label *lb = b;
+	return !strcmp(la->name, lb->name);
+}
+
+static void session_label_del(void *p){
+	struct session_label *label = p;
+	argon_free(label->name);
+	argon_free(label);
+}
+
+static struct session_label *session_label_find(struct session *s, const char *name){
+	struct session_label needle = { (char *)name, 0 };
+	return htab_find(s->labels, &needle);
+}
+
+/**
+ * @return 0 on success, -1 if the label is already defined or on allocation failure
+ */
+static int session_label_add(struct session *s, const char *name, size_t offset){
+	struct session_label needle = { (char *)name, 0 };
+	void **slot = htab_find_slot(s->labels, &needle, INSERT);
+	if(slot == NULL){
+		return -1;
+	}
+	if(*slot != NULL){
+		fprintf(stderr, "argon_session: label \"%s\" already defined\n", name);
+		return -1;
+	}
+
+	struct session_label *label = argon_malloc(sizeof(*label));
+	if(label == NULL){
+		return -1;
+	}
+	label->name = argon_strdup(name);
+	label->offset = offset;
+	*slot = label;
+	return 0;
+}
+
+static int session_fixup_defer(struct session *s, const char *symbol, const void *howto, size_t offset, int64_t addend){
+	if(s->npending == s->pending_capacity){
+		size_t capacity = (s->pending_capacity > 0) ? s->pending_capacity * 2 : 16;
+		struct session_fixup *pending = argon_malloc(capacity * sizeof(*pending));
+		if(pending == NULL){
+			return -1;
+		}
+		if(s->npending > 0){
+			memcpy(pending, s->pending, s->npending * sizeof(*pending));
+		}
+		argon_free(s->pending);
+		s->pending = pending;
+		s->pending_capacity = capacity;
+	}
+
+	struct session_fixup *fix = &s->pending[s->npending++];
+	fix->symbol = argon_strdup(symbol);
+	fix->howto = howto;
+	fix->offset = offset;
+	fix->addend = addend;
+	return 0;
+}
+
+static int session_patch(struct session *s, const void *howto, size_t offset, size_t target, int64_t addend){
+	int rc = argon_bfd_data_patch(howto,
+		s->start + offset, s->start + target, addend);
+	if(rc < 0){
+		fputs("argon_session: relocation overflow\n", stderr);
+	}
+	return rc;
+}
+
+/**
+ * @brief Patches the pending references to labels that are now defined
+ */
+static int session_resolve_pending(struct session *s){
+	int rc = 0;
+	size_t kept = 0;
+	for(size_t i=0; i<s->npending; i++){
+		struct session_fixup *fix = &s->pending[i];
+		struct session_label *label = session_label_find(s, fix->symbol);
+		if(label == NULL){
+			s->pending[kept++] = *fix;
+			continue;
+		}
+		if(session_patch(s, fix->howto, fix->offset, label->offset, fix->addend) < 0){
+			rc = -1;
+		}
+		argon_free(fix->symbol);
+	}
+	s->npending = kept;
+	return rc;
+}
+
+/**
+ * @brief Starts a session at the current position of the output buffer.
+ * GAS must be fully initialized already
+ *
+ * @return 0 on success, -1 if a session is already active
+ */
+int argon_session_begin(){
+	struct session *s = &g_session;
+	if(s->active){
+		return -1;
+	}
+
+	s->labels = htab_create_alloc(64,
+		session_label_hash, session_label_eq, session_label_del,
+		__real_calloc, __real_free);
+	if(s->labels == NULL){
+		return -1;
+	}
+	s->start = argon_bfd_data_written();
+	s->size = 0;
+	s->npending = 0;
+	s->active = 1;
+	return 0;
+}
+
+/**
+ * @brief Appends lines to the session.
+ * The new bytes are written right after the previous ones,
+ * bytes of earlier appends are patched as their forward references get resolved
+ *
+ * @param lines lines to assemble (instructions or "name:" labels)
+ * @param n number of lines
+ * @param[out] offsets if not NULL, receives the offset of each line in the session
+ * @return 0 on success, -1 on error
+ */
+int argon_session_append(const char **lines, size_t n, size_t *offsets){
+	struct session *s = &g_session;
+	if(!s->active){
+		return -1;
+	}
+
+	// prefer the saved state, if there's a checkpoint
+	if(argon_restore() < 0){
+		argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+	}
+	size_t chunk = s->size;
+	argon_fseek(s->start + chunk, SEEK_SET);
+
+	int rc = argon_assemble_batch(lines, n, offsets);
+	if(argon_session_collect() < 0){
+		rc = -1;
+	}
+
+	if(offsets != NULL){
+		for(size_t i=0; i<n; i++){
+			offsets[i] += chunk;
+		}
+	}
+	return rc;
+}
+
+/**
+ * @brief Adds the last write to the session: records its labels
+ * and resolves its references, as argon_session_append does.
+ * The write must start at the end of the session (e.g. argon_assemble_stream)
+ *
+ * @return 0 on success, -1 on error
+ */
+int argon_session_collect(){
+	struct session *s = &g_session;
+	if(!s->active){
+		return -1;
+	}
+
+	int rc = 0;
+	size_t chunk = s->size;
+	s->size = argon_bfd_data_written() - s->start;
+
+	// labels defined by this write
+	size_t nsymbols = argon_bfd_data_symbol_count();
+	for(size_t i=0; i<nsymbols; i++){
+		struct argon_symbol sym;
+		if(argon_bfd_data_symbol_get(i, &sym) < 0
+		|| (sym.flags & BSF_SECTION_SYM) != 0
+		|| strcmp(sym.section, TEXT_SECTION_NAME) != 0
+		){
+			continue;
+		}
+		if(session_label_add(s, sym.name, chunk + sym.value) < 0){
+			rc = -1;
+		}
+	}
+
+	if(session_resolve_pending(s) < 0){
+		rc = -1;
+	}
+
+	// references GAS couldn't resolve
+	size_t nfixups = argon_bfd_data_fixup_count();
+	for(size_t i=0; i<nfixups; i++){
+		struct argon_fixup fix;
+		if(argon_bfd_data_fixup_get(i, &fix) < 0
+		|| fix.symbol == NULL
+		|| strcmp(fix.section, TEXT_SECTION_NAME) != 0
+		){
+			continue;
+		}
+		const void *howto = argon_bfd_data_fixup_howto(i);
+		size_t offset = chunk + fix.offset;
+
+		struct session_label *label = session_label_find(s, fix.symbol);
+		if(label != NULL){
+			if(session_patch(s, howto, offset, label->offset, fix.addend) < 0){
+				rc = -1;
+			}
+		} else if(!strcmp(fix.symbol, TEXT_SECTION_NAME)){
+			// local reference, made relative to this write's .text
+			if(session_patch(s, howto, offset, chunk, fix.addend) < 0){
+				rc = -1;
+			}
+		} else if(session_fixup_defer(s, fix.symbol, howto, offset, fix.addend) < 0){
+			rc = -1;
+		}
+	}
+	return rc;
+}
+
+/**
+ * @brief Returns the number of bytes written by the session so far
+ */
+size_t argon_session_size(){
+	return g_session.size;
+}
+
+/**
+ * @brief Returns the number of references to labels that aren't defined yet
+ */
+size_t argon_session_pending(){
+	return g_session.npending;
+}
+
+/**
+ * @brief Looks up a label defined by the session
+ *
+ * @param name
+ * @param[out] offset offset of the label in the session
+ * @return 0 on success, -1 if the label isn't defined
+ */
+int argon_session_label(const char *name, size_t *offset){
+	struct session *s = &g_session;
+	if(!s->active){
+		return -1;
+	}
+	struct session_label *label = session_label_find(s, name);
+	if(label == NULL){
+		return -1;
+	}
+	*offset = label->offset;
+	return 0;
+}
+
+/**
+ * @brief Ends the session, forgetting its labels.
+ *
+ * @return 0 on success, -1 if references to undefined labels are left
+ */
+int argon_session_end(){
+	struct session *s = &g_session;
+	if(!s->active){
+		return -1;
+	}
+
+	int rc = 0;
+	for(size_t i=0; i<s->npending; i++){
+		fprintf(stderr, "argon_session: undefined label \"%s\"\n", s->pending[i].symbol);
+		argon_free(s->pending[i].symbol);
+		rc = -1;
+	}
+	argon_free(s->pending);
+	htab_delete(s->labels);
+	memset(s, 0x00, sizeof(*s));
+	return rc;
+}
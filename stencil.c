@@ -0,0 +1,357 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * @file stencil.c
+ * @author Stefano Moioli <smxdev4@gmail.com>
+ * @brief Stencils: lines assembled once, with holes patched later
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) Stefano Moioli 2022
+ */
+#include "as.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bfd.h"
+
+#include "argon.h"
+#include "argon_api.h"
+
+/**
+ * a stencil is a line with named holes, e.g. "mov rax, offset ${imm}".
+ * each hole is replaced by an undefined symbol, so GAS picks an encoding
+ * that can hold any value of the field, and leaves a relocation for it:
+ * the relocation gives the position and encoding of the hole.
+ *
+ * instantiating a stencil copies the bytes and applies the relocations
+ * with the values of the holes, without going through GAS.
+ * values that don't fit the field (i.e. that would need a longer
+ * encoding) are rejected, as are holes spread over several fields
+ * (e.g. hi/lo pairs of a "li" macro)
+ */
+
+#define STENCIL_HOLE_PREFIX "__argon_hole_"
+// longest hole name
+#define STENCIL_NAME_MAX 64
+
+extern size_t argon_bfd_data_written();
+extern void argon_fseek(long offset, int whence);
+extern int argon_assemble_batch(const char **lines, size_t n, size_t *offsets);
+// from libbfd.h
+extern bfd_reloc_status_type _bfd_relocate_contents(reloc_howto_type *howto, bfd *input_bfd, bfd_vma relocation, bfd_byte *location);
+
+struct stencil_hole {
+	struct argon_stencil_hole pub;
+	reloc_howto_type *howto;
+	// number of relocations seen for the hole
+	unsigned nfields;
+};
+
+struct argon_stencil {
+	uint8_t *data;
+	size_t size;
+	struct stencil_hole *holes;
+	size_t nholes;
+};
+
+/**
+ * @brief Replaces the holes with symbols, and records their names
+ *
+ * @return the line as seen by GAS, or NULL on error
+ */
+static char *stencil_expand(struct argon_stencil *st, const char *text){
+	size_t len = strlen(text);
+	size_t max_holes = 0;
+	for(const char *p = text; (p = strstr(p, "${")) != NULL; p += 2){
+		max_holes++;
+	}
+
+	// a hole symbol is never longer than the prefix and a 20 digit index
+	size_t line_size = len + max_holes * (sizeof(STENCIL_HOLE_PREFIX) + 20) + 1;
+	char *line = argon_malloc(line_size);
+	if(max_holes > 0){
+		st->holes = argon_malloc(max_holes * sizeof(*st->holes));
+	}
+	if(line == NULL || (max_holes > 0 && st->holes == NULL)){
+		argon_free(line);
+		return NULL;
+	}
+
+	char *out = line;
+	const char *p = text;
+	while(*p != '\0'){
+		if(p[0] != '$' || p[1] != '{'){
+			*(out++) = *(p++);
+			continue;
+		}
+		const char *name = p + 2;
+		const char *end = name;
+		while(is_part_of_name(*end) && *end != '$') end++;
+
+		size_t name_len = end - name;
+		if(*end != '}' || name_len == 0 || name_len > STENCIL_NAME_MAX){
+			fprintf(stderr, "argon_stencil: malformed hole in \"%s\"\n", text);
+			argon_free(line);
+			return NULL;
+		}
+		for(size_t i=0; i<st->nholes; i++){
+			const char *other = st->holes[i].pub.name;
+			if(strlen(other) == name_len && !strncmp(other, name, name_len)){
+				fprintf(stderr, "argon_stencil: hole \"%s\" used twice\n", other);
+				argon_free(line);
+				return NULL;
+			}
+		}
+
+		struct stencil_hole *hole = &st->holes[st->nholes];
+		memset(hole, 0x00, sizeof(*hole));
+		char *hole_name = argon_malloc(name_len + 1);
+		if(hole_name == NULL){
+			argon_free(line);
+			return NULL;
+		}
+		memcpy(hole_name, name, name_len);
+		hole_name[name_len] = '\0';
+		hole->pub.name = hole_name;
+
+		out += sprintf(out, STENCIL_HOLE_PREFIX "%zu", st->nholes);
+		st->nholes++;
+		p = end + 1;
+	}
+	*out = '\0';
+	return line;
+}
+
+/**
+ * @brief Maps a relocation of the template to its hole
+ *
+ * @return 0 on success, -1 if the relocation isn't for a hole
+ */
+static int stencil_hole_add_fixup(struct argon_stencil *st, size_t index, const struct argon_fixup *fix){
+	size_t prefix_len = sizeof(STENCIL_HOLE_PREFIX) - 1;
+	if(fix->symbol == NULL || strncmp(fix->symbol, STENCIL_HOLE_PREFIX, prefix_len) != 0){
+		fprintf(stderr, "argon_stencil: unresolved reference to \"%s\"\n",
+			(fix->symbol != NULL) ? fix->symbol : "(none)");
+		return -1;
+	}
+
+	char *end;
+	size_t hole_index = strtoul(fix->symbol + prefix_len, &end, 10);
+	if(*end != '\0' || hole_index >= st->nholes){
+		return -1;
+	}
+
+	struct stencil_hole *hole = &st->holes[hole_index];
+	if(++hole->nfields > 1){
+		fprintf(stderr, "argon_stencil: hole \"%s\" spans several fields\n", hole->pub.name);
+		return -1;
+	}
+
+	reloc_howto_type *howto = (reloc_howto_type *)argon_bfd_data_fixup_howto(index);
+	if(howto == NULL){
+		return -1;
+	}
+	hole->howto = howto;
+	hole->pub.offset = fix->offset;
+	hole->pub.size = fix->size;
+	hole->pub.bitsize = howto->bitsize;
+	hole->pub.bitpos = howto->bitpos;
+	hole->pub.rightshift = howto->rightshift;
+	hole->pub.pc_relative = fix->pc_relative;
+	hole->pub.type = fix->type;
+	// static, unlike fix->type_name
+	hole->pub.type_name = howto->name;
+	hole->pub.addend = fix->addend;
+	return 0;
+}
+
+/**
+ * @brief Collects the bytes and the holes of the last write
+ */
+static int stencil_capture(struct argon_stencil *st){
+	struct argon_section text;
+	if(argon_bfd_data_section_count() != 1
+	|| argon_bfd_data_section_find(TEXT_SECTION_NAME, &text) < 0
+	){
+		fputs("argon_stencil: the line must only write to " TEXT_SECTION_NAME "\n", stderr);
+		return -1;
+	}
+
+	size_t nfixups = argon_bfd_data_fixup_count();
+	for(size_t i=0; i<nfixups; i++){
+		struct argon_fixup fix;
+		if(argon_bfd_data_fixup_get(i, &fix) < 0
+		|| stencil_hole_add_fixup(st, i, &fix) < 0
+		){
+			return -1;
+		}
+	}
+	for(size_t i=0; i<st->nholes; i++){
+		if(st->holes[i].nfields == 0){
+			fprintf(stderr, "argon_stencil: hole \"%s\" isn't a relocatable field\n",
+				st->holes[i].pub.name);
+			return -1;
+		}
+	}
+
+	st->size = text.size;
+	st->data = argon_malloc((text.size > 0) ? text.size : 1);
+	if(st->data == NULL){
+		return -1;
+	}
+	memcpy(st->data, text.data, text.size);
+	return 0;
+}
+
+/**
+ * @brief Assembles a line with holes ("${name}") into a stencil.
+ * GAS must be initialized. The output buffer is left as it was
+ *
+ * On x86 with Intel syntax, immediate holes are written as "offset ${name}"
+ *
+ * @param text the line
+ * @return the stencil, or NULL on error
+ */
+struct argon_stencil *argon_stencil_create(const char *text){
+	struct argon_stencil *st = argon_malloc(sizeof(*st));
+	if(st == NULL){
+		return NULL;
+	}
+	memset(st, 0x00, sizeof(*st));
+
+	char *line = stencil_expand(st, text);
+	if(line == NULL){
+		argon_stencil_free(st);
+		return NULL;
+	}
+
+	size_t pos = argon_bfd_data_written();
+	const char *lines[] = { line };
+	int rc = argon_assemble_batch(lines, 1, NULL);
+	if(rc == 0){
+		rc = stencil_capture(st);
+	}
+	// the template isn't part of the output
+	argon_fseek(pos, SEEK_SET);
+	argon_free(line);
+
+	if(rc < 0){
+		argon_stencil_free(st);
+		return NULL;
+	}
+	return st;
+}
+
+void argon_stencil_free(struct argon_stencil *st){
+	if(st == NULL){
+		return;
+	}
+	for(size_t i=0; i<st->nholes; i++){
+		argon_free((char *)st->holes[i].pub.name);
+	}
+	argon_free(st->holes);
+	argon_free(st->data);
+	argon_free(st);
+}
+
+size_t argon_stencil_size(const struct argon_stencil *st){
+	return st->size;
+}
+
+const uint8_t *argon_stencil_data(const struct argon_stencil *st){
+	return st->data;
+}
+
+size_t argon_stencil_hole_count(const struct argon_stencil *st){
+	return st->nholes;
+}
+
+int argon_stencil_hole_get(const struct argon_stencil *st, size_t index, struct argon_stencil_hole *hole){
+	if(index >= st->nholes){
+		return -1;
+	}
+	*hole = st->holes[index].pub;
+	return 0;
+}
+
+/**
+ * @return index of the hole, or -1 if there's no such hole
+ */
+int argon_stencil_hole_find(const struct argon_stencil *st, const char *name){
+	for(size_t i=0; i<st->nholes; i++){
+		if(!strcmp(st->holes[i].pub.name, name)){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Checks that a value can be stored in a field as is.
+ * BFD only checks the range for some relocations, and drops
+ * the bits removed by rightshift
+ */
+static int stencil_value_fits(reloc_howto_type *howto, bfd_vma value){
+	if(howto->rightshift > 0 && (value & (((bfd_vma)1 << howto->rightshift) - 1)) != 0){
+		return 0;
+	}
+	unsigned bits = howto->bitsize + howto->rightshift;
+	if(howto->complain_on_overflow != complain_overflow_dont || bits >= 64){
+		return 1;
+	}
+	// either sign or zero extended
+	bfd_signed_vma top = (bfd_signed_vma)value >> (bits - 1);
+	return top == 0 || top == -1 || (value >> bits) == 0;
+}
+
+/**
+ * @brief Writes the value of a hole in an instance of the stencil
+ *
+ * @param dst the instance (a copy of argon_stencil_data)
+ * @param address address the instance will run at, for pc-relative holes
+ * @param index index of the hole
+ * @param value value of the hole (the target address, for pc-relative holes)
+ * @return 0 on success, -1 if the value doesn't fit the field
+ */
+int argon_stencil_patch(const struct argon_stencil *st, void *dst, uint64_t address, size_t index, uint64_t value){
+	if(index >= st->nholes || stdoutput == NULL){
+		return -1;
+	}
+	const struct stencil_hole *hole = &st->holes[index];
+	uint8_t *field = (uint8_t *)dst + hole->pub.offset;
+
+	bfd_vma v = value + hole->pub.addend;
+	if(hole->pub.pc_relative){
+		v -= address + hole->pub.offset;
+	}
+	if(!stencil_value_fits(hole->howto, v)){
+		return -1;
+	}
+
+	// in-place addends are added to the field, start from the template
+	memcpy(field, &st->data[hole->pub.offset], hole->pub.size);
+	bfd_reloc_status_type status = _bfd_relocate_contents(hole->howto, stdoutput, v, field);
+	return (status == bfd_reloc_ok) ? 0 : -1;
+}
+
+/**
+ * @brief Writes an instance of the stencil
+ *
+ * @param dst receives argon_stencil_size bytes
+ * @param address address the instance will run at, for pc-relative holes
+ * @param values value of each hole, in hole order
+ * @return 0 on success, -1 if a value doesn't fit its field
+ */
+int argon_stencil_instantiate(const struct argon_stencil *st, void *dst, uint64_t address, const uint64_t *values){
+	memcpy(dst, st->data, st->size);
+	int rc = 0;
+	for(size_t i=0; i<st->nholes; i++){
+		if(argon_stencil_patch(st, dst, address, i, values[i]) < 0){
+			rc = -1;
+		}
+	}
+	return rc;
+}
@@ -0,0 +1,381 @@
+/**
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * @file stream.c
+ * @author Stefano Moioli <smxdev4@gmail.com>
+ * @brief Streaming assembly of large sources, with bounded memory
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) Stefano Moioli 2022
+ */
+#include "as.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <strings.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef TARGET_USE_CFIPOP
+#include "dw2gencfi.h"
+#endif
+
+#include "argon.h"
+#include "argon_api.h"
+
+/**
+ * the source is fed to the GAS reader (read_a_source_file) in chunks,
+ * so directives, labels and macros work as with the real assembler.
+ * after each chunk (flush point) the object is written and
+ * the live pool is recycled, so memory doesn't grow with the source.
+ *
+ * chunks only end at line boundaries outside of .macro, .rept/.irp
+ * and .if blocks. macro definitions are replayed in front of the
+ * following chunks; any other state (symbols, .set values, the current
+ * section) starts over at every flush point, so references to labels
+ * of another chunk are left as relocations.
+ * when the chunks are concatenated in the output buffer, the stream runs
+ * as a session (session.c), which patches the references to .text labels
+ * of other chunks. anything else that can't be represented by the
+ * concatenated .text (a .set constant of another chunk, other sections,
+ * absolute addresses without a vma) fails the stream.
+ *
+ * .cfi and debug directives keep state that isn't reset by argon_init_gas:
+ * make a checkpoint (argon_checkpoint) before streaming sources that use them
+ */
+
+#define STREAM_FLUSH_SIZE_DEFAULT (1024 * 1024)
+
+// name of the in-memory source, as seen by GAS
+#define STREAM_FILE_NAME "{argon stream}"
+
+extern uint8_t *argon_init_gas(size_t bufferSize, unsigned flags);
+extern void argon_fseek(long offset, int whence);
+extern size_t argon_bfd_data_written();
+
+struct stream_state {
+	// nesting of .macro/.rept/.if blocks at the end of the scanned text
+	int depth;
+	// start of the macro definition being scanned
+	const char *macro_start;
+	// definitions seen so far, replayed in front of each chunk
+	char *macros;
+	size_t macros_size;
+	size_t macros_capacity;
+	// prefix + chunk, as fed to GAS
+	char *source;
+	size_t source_capacity;
+};
+
+static int stream_buffer_reserve(char **buf, size_t *capacity, size_t size){
+	if(size <= *capacity){
+		return 0;
+	}
+	size_t new_capacity = (*capacity > 0) ? *capacity : 4096;
+	while(new_capacity < size) new_capacity *= 2;
+
+	char *mem = argon_malloc(new_capacity);
+	if(mem == NULL){
+		return -1;
+	}
+	if(*buf != NULL){
+		memcpy(mem, *buf, *capacity);
+		argon_free(*buf);
+	}
+	*buf = mem;
+	*capacity = new_capacity;
+	return 0;
+}
+
+/**
+ * @brief Checks if a line starts with the given directive
+ *
+ * @param prefix if non zero, any directive starting with name matches
+ */
+static int stream_line_is(const char *p, const char *end, const char *name, int prefix){
+	while(p < end && ISSPACE(*p)) p++;
+
+	size_t len = strlen(name);
+	if((size_t)(end - p) < len || strncasecmp(p, name, len) != 0){
+		return 0;
+	}
+	p += len;
+	if(prefix){
+		while(p < end && is_part_of_name(*p)) p++;
+	}
+	return p == end || ISSPACE(*p);
+}
+
+/**
+ * @brief Tracks block nesting and collects macro definitions
+ *
+ * @param line start of the line
+ * @param eol end of the line, including the newline
+ */
+static int stream_scan_line(struct stream_state *st, const char *line, const char *eol){
+	if(stream_line_is(line, eol, ".macro", 0)){
+		if(st->depth == 0){
+			st->macro_start = line;
+		}
+		st->depth++;
+	} else if(stream_line_is(line, eol, ".rept", 0)
+		|| stream_line_is(line, eol, ".irp", 1)
+		|| stream_line_is(line, eol, ".if", 1)
+	){
+		st->depth++;
+	} else if(stream_line_is(line, eol, ".endm", 0)
+		|| stream_line_is(line, eol, ".endr", 0)
+		|| stream_line_is(line, eol, ".endif", 0)
+	){
+		if(st->depth > 0){
+			st->depth--;
+		}
+		if(st->depth == 0 && st->macro_start != NULL){
+			size_t size = eol - st->macro_start;
+			if(stream_buffer_reserve(&st->macros, &st->macros_capacity, st->macros_size + size + 1) < 0){
+				return -1;
+			}
+			memcpy(&st->macros[st->macros_size], st->macro_start, size);
+			st->macros_size += size;
+			if(eol[-1] != '\n'){
+				st->macros[st->macros_size++] = '\n';
+			}
+			st->macro_start = NULL;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Runs one chunk through the GAS reader and writes the object
+ *
+ * @return 0 on success, -1 if GAS reported errors
+ */
+static int stream_assemble_chunk(struct stream_state *st, size_t nmacros, const char *text, size_t size, size_t output_pos){
+	// the previous chunk is gone from GAS memory after this
+	int restored = (argon_restore() == 0);
+	if(!restored){
+		argon_init_gas(0, ARGON_KEEP_BUFFER | ARGON_SKIP_INIT);
+	}
+	argon_fseek(output_pos, SEEK_SET);
+
+	size_t source_size = nmacros + size;
+	if(stream_buffer_reserve(&st->source, &st->source_capacity, source_size + 1) < 0){
+		return -1;
+	}
+	if(nmacros > 0){
+		memcpy(st->source, st->macros, nmacros);
+	}
+	memcpy(&st->source[nmacros], text, size);
+	st->source[source_size] = '\0';
+
+	int errors = had_errors();
+
+	argon_md_begin();
+	argon_stream_source_set(STREAM_FILE_NAME, st->source, source_size);
+	input_scrub_begin();
+	read_a_source_file(STREAM_FILE_NAME);
+	input_scrub_end();
+	argon_stream_source_set(NULL, NULL, 0);
+
+#ifdef TARGET_USE_CFIPOP
+	// only safe with a fresh cfi state
+	if(restored){
+		cfi_finish();
+	}
+#endif
+
+	argon_bfd_data_begin();
+	write_object_file();
+	return (had_errors() > errors) ? -1 : 0;
+}
+
+/**
+ * @brief Checks that the last write is fully described by its .text,
+ * once the session has resolved the references to labels
+ *
+ * @return 0 on success, -1 if another section has contents
+ *   or a reference without a symbol is left
+ */
+static int stream_check_output(){
+	int rc = 0;
+	size_t nsections = argon_bfd_data_section_count();
+	for(size_t i=0; i<nsections; i++){
+		struct argon_section sec;
+		if(argon_bfd_data_section_get(i, &sec) < 0
+		|| !strcmp(sec.name, TEXT_SECTION_NAME)
+		|| (sec.flags & SEC_ALLOC) == 0
+		|| sec.size == 0
+		){
+			continue;
+		}
+		fprintf(stderr, "argon_assemble_stream: %s isn't part of the output\n", sec.name);
+		rc = -1;
+	}
+
+	size_t nfixups = argon_bfd_data_fixup_count();
+	for(size_t i=0; i<nfixups; i++){
+		struct argon_fixup fix;
+		if(argon_bfd_data_fixup_get(i, &fix) < 0
+		|| fix.symbol != NULL
+		|| strcmp(fix.section, TEXT_SECTION_NAME) != 0
+		){
+			continue;
+		}
+		fprintf(stderr, "argon_assemble_stream: unresolved %s at .text+0x%llx\n",
+			fix.type_name, (unsigned long long)fix.offset);
+		rc = -1;
+	}
+	return rc;
+}
+
+/**
+ * @brief Assembles a source in chunks, through the GAS reader.
+ *
+ * @param text source text
+ * @param size size of text
+ * @param flush_size approximate size of a chunk (0 for the default)
+ * @param fn if not NULL, called after each chunk with its output
+ *   (argon_bfd_data_*), which is overwritten by the next one.
+ *   if NULL, the .text of each chunk is appended to the output buffer,
+ *   with the references across chunks resolved (a session must not be active)
+ * @param opaque passed to fn as is
+ * @return 0 on success, -1 if GAS reported errors or fn stopped the stream.
+ *   without fn, also if the concatenated .text is incomplete
+ *   (undefined labels, other sections, unresolved relocations)
+ */
+int argon_assemble_stream(const char *text, size_t size, size_t flush_size, argon_stream_fn fn, void *opaque){
+#ifdef WIN32
+	(void)text;
+	(void)size;
+	(void)flush_size;
+	(void)fn;
+	(void)opaque;
+	fputs("argon_assemble_stream: fmemopen() not supported on Windows\n", stderr);
+	return -1;
+#else
+	if(flush_size == 0){
+		flush_size = STREAM_FLUSH_SIZE_DEFAULT;
+	}
+
+	struct stream_state st;
+	memset(&st, 0x00, sizeof(st));
+
+	int rc = 0;
+	struct argon_stream_chunk chunk;
+	memset(&chunk, 0x00, sizeof(chunk));
+
+	size_t output_pos = argon_bfd_data_written();
+	size_t output_total = 0;
+
+	// starts at output_pos
+	if(fn == NULL && argon_session_begin() < 0){
+		fputs("argon_assemble_stream: a session is already active\n", stderr);
+		return -1;
+	}
+
+	const char *p = text;
+	const char *end = text + size;
+	while(p < end){
+		const char *chunk_start = p;
+		// macros defined by this chunk are only replayed in the next ones
+		size_t nmacros = st.macros_size;
+
+		while(p < end){
+			const char *eol = memchr(p, '\n', end - p);
+			eol = (eol != NULL) ? eol + 1 : end;
+			if(stream_scan_line(&st, p, eol) < 0){
+				rc = -1;
+				goto out;
+			}
+			p = eol;
+			if((size_t)(p - chunk_start) >= flush_size && st.depth == 0){
+				break;
+			}
+		}
+
+		chunk.source_offset = chunk_start - text;
+		chunk.source_size = p - chunk_start;
+		chunk.status = stream_assemble_chunk(&st, nmacros,
+			chunk_start, chunk.source_size, output_pos);
+		if(chunk.status < 0){
+			rc = -1;
+		}
+
+		chunk.output_offset = output_total;
+		chunk.output_size = argon_bfd_data_written() - output_pos;
+		output_total += chunk.output_size;
+		if(fn == NULL){
+			output_pos += chunk.output_size;
+			if(argon_session_collect() < 0
+			|| stream_check_output() < 0
+			){
+				rc = -1;
+			}
+		} else if(fn(&chunk, opaque) != 0){
+			rc = -1;
+			break;
+		}
+		chunk.index++;
+	}
+
+out:
+	// fails if labels are still undefined
+	if(fn == NULL && argon_session_end() < 0){
+		rc = -1;
+	}
+	argon_free(st.macros);
+	argon_free(st.source);
+	return rc;
+#endif
+}
+
+/**
+ * @brief Same as argon_assemble_stream, reading the source from a file.
+ * The file is mapped, not read into memory
+ */
+int argon_assemble_file(const char *path, size_t flush_size, argon_stream_fn fn, void *opaque){
+#ifdef WIN32
+	(void)path;
+	(void)flush_size;
+	(void)fn;
+	(void)opaque;
+	return -1;
+#else
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		perror(path);
+		return -1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) < 0){
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+	if(st.st_size == 0){
+		close(fd);
+		return 0;
+	}
+
+	void *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(text == MAP_FAILED){
+		perror("mmap");
+		return -1;
+	}
+	// read once, front to back
+	madvise(text, st.st_size, MADV_SEQUENTIAL);
+
+	int rc = argon_assemble_stream(text, st.st_size, flush_size, fn, opaque);
+	munmap(text, st.st_size);
+	return rc;
+#endif
+}
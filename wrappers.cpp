@@ -17,38 +17,95 @@
 #include <cstring>
 #include <algorithm>
 
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
 #include "argon.h"
+#include "argon_api.h"
 
 //#define DEBUG
-#ifdef DEBUG
-#include <unordered_map>
-struct alloc_info {
-	std::vector<void *> bt;
+
+/**
+ * every hooked allocation is prefixed by this header.
+ * it tells which pool owns the block, so that free/realloc
+ * don't need to look the pointer up
+ */
+struct alloc_hdr {
+	struct alloc_hdr *prev;
+	struct alloc_hdr *next;
 	size_t size;
+	uint32_t pool;
+	uint32_t flags;
+	// allocation site (DEBUG only)
+	void *caller;
+	/**
+	 * must be the last field: it's the only one read
+	 * before knowing if the pointer is ours
+	 */
+	uintptr_t magic;
 };
-using pool_t = std::unordered_set<void *, alloc_info>;
+static_assert(sizeof(struct alloc_hdr) % 16 == 0, "alloc_hdr breaks malloc alignment");
 
-static inline __attribute__((always_inline))
-struct alloc_info make_info(size_t size){
-	struct alloc_info info;
-	info.size = size;
-	info.bt.push_back(__builtin_return_address(0));
-	info.bt.push_back(__builtin_return_address(1));
-	info.bt.push_back(__builtin_return_address(2));
-	info.bt.push_back(__builtin_return_address(3));
-	info.bt.push_back(__builtin_return_address(4));
-	return info;
-}
-#else
-#include <unordered_set>
-using pool_t = std::unordered_set<void *>;
-#endif
+#define ALLOC_MAGIC ((uintptr_t)0x4E4F475241L)
+#define ALLOC_REGION (1 << 0)
+// part of a checkpoint: never released or moved until the checkpoint is dropped
+#define ALLOC_PINNED (1 << 1)
+
+// internal pool holding the checkpointed blocks
+#define POOL_PINNED (1 << 8)
+
+struct pool_t {
+	struct alloc_hdr *head;
+	size_t count;
+	size_t bytes;
+};
+
+static pool_t init_pool ARGON_PERSIST;
+static pool_t live_pool ARGON_PERSIST;
+static pool_t pinned_pool ARGON_PERSIST;
+static int g_pool_selector ARGON_PERSIST = ARGON_POOL_LIVE;
+
+/**
+ * pinned memory, one range per block (or region chunk),
+ * and a copy of its contents at checkpoint time
+ */
+struct pin_range {
+	uint8_t *start;
+	size_t size;
+};
+static struct pin_range *pin_ranges ARGON_PERSIST = nullptr;
+static size_t pin_nranges ARGON_PERSIST = 0;
+static uint8_t *pin_image ARGON_PERSIST = nullptr;
+static bool pin_valid ARGON_PERSIST = false;
 
-static pool_t init_pool;
-static pool_t live_pool;
-static int g_pool_selector = ARGON_POOL_LIVE;
+#ifdef ARGON_LIVE_REGION
+/**
+ * the live pool is served by a bump allocator.
+ * chunks are kept across GC cycles, so that resetting the pool
+ * is just a matter of rewinding to the first chunk
+ */
+#define REGION_CHUNK_SIZE (256 * 1024)
+#define REGION_ALIGN 16
+
+struct region_chunk {
+	struct region_chunk *next;
+	size_t size;
+	size_t used;
+	size_t pad;
+	uint8_t data[];
+};
 
-static thread_local bool in_malloc = false;
+static struct region_chunk *region_head ARGON_PERSIST = nullptr;
+static struct region_chunk *region_cur ARGON_PERSIST = nullptr;
+// most recent allocation, can be grown or released in place
+static struct alloc_hdr *region_last ARGON_PERSIST = nullptr;
+// end of the checkpointed part of the region
+static struct region_chunk *region_mark ARGON_PERSIST = nullptr;
+static size_t region_mark_used ARGON_PERSIST = 0;
+#endif
 
 extern "C" {
 
@@ -62,17 +119,15 @@ extern void __real_free(void *ptr);
 extern void *__real_calloc(size_t nmemb, size_t size);
 extern void *__real_realloc(void *ptr, size_t size);
 
+// from GAS and BFD
+extern bfd *stdoutput;
+extern bfd_reloc_status_type _bfd_relocate_contents(reloc_howto_type *, bfd *, bfd_vma, bfd_byte *);
+
 static void *(*pfn_malloc)(size_t size) = &__real_malloc;
 static void (*pfn_free)(void *ptr) = &__real_free;
 static void *(*pfn_calloc)(size_t nmemb, size_t size) = &__real_calloc;
 static void *(*pfn_realloc)(void *ptr, size_t size) = &__real_realloc;
 
-int __argon_tls_init(){
-	// make sure the TLS variable is initialized by accessing it
-	::in_malloc = false;
-	return ::in_malloc;
-}
-
 void argon_gc_enable(int enable){
 	if(enable){
 		pfn_malloc = &hooked_malloc;
@@ -100,252 +155,1659 @@ void __wrap_free(void *ptr){
 	return pfn_free(ptr);
 }
 
-static inline __attribute__((always_inline)) 
-pool_t& pool_get(){
-	switch(::g_pool_selector){
+static inline __attribute__((always_inline))
+pool_t& pool_get(int pool_selector){
+	switch(pool_selector){
 		case ARGON_POOL_INIT: return init_pool;
+		case POOL_PINNED: return pinned_pool;
 		case ARGON_POOL_LIVE:
 		default:
 			return live_pool;
 	}
 }
 
-static inline __attribute__((always_inline)) 
-void pool_insert(void *ptr, size_t size){
-	pool_t& pool = pool_get();
-#ifdef DEBUG
-	pool[ptr] = make_info(size);
-#else
-	pool.insert(ptr);
-#endif
+static inline __attribute__((always_inline))
+uintptr_t hdr_magic(struct alloc_hdr *hdr){
+	return ALLOC_MAGIC ^ reinterpret_cast<uintptr_t>(hdr);
 }
 
-static inline __attribute__((always_inline)) 
-void pool_remove(void *ptr){
-	static pool_t& pool = pool_get();
-	pool.erase(ptr);
+static inline __attribute__((always_inline))
+struct alloc_hdr *hdr_get(void *ptr){
+	return static_cast<struct alloc_hdr *>(ptr) - 1;
 }
 
-static uint8_t *bfd_data = nullptr;
-static size_t bfd_data_size = 0;
-static size_t bfd_data_count = 0;
-
 /**
- * these hooks are needed to avoid a crash
- * since we are working on an uninitialized ELF file 
+ * @brief Returns the header of a hooked allocation, or NULL
+ * if the pointer comes from the real allocator.
+ * Every pointer handed out by the hooks carries a header; the only
+ * foreign pointers are the ones allocated by libc itself (strdup, realpath...).
+ * For those, the only word read is the one right before the pointer
+ * (the magic), which is the size field of the malloc chunk
  */
-uintptr_t __wrap_bfd_elf_obj_attr_size (void *abfd){
-	return 0;
+static inline __attribute__((always_inline))
+struct alloc_hdr *hdr_find(void *ptr){
+	if(ptr == nullptr){
+		return nullptr;
+	}
+	struct alloc_hdr *hdr = hdr_get(ptr);
+	if(hdr->magic != hdr_magic(hdr)){
+		return nullptr;
+	}
+	return hdr;
 }
-bool __wrap_bfd_set_symtab (void *abfd, void **location, unsigned int symcount){
-	return true;
+
+static inline __attribute__((always_inline))
+void *hdr_init(struct alloc_hdr *hdr, size_t size, int pool_selector, uint32_t flags){
+	hdr->size = size;
+	hdr->pool = pool_selector;
+	hdr->flags = flags;
+#ifdef DEBUG
+	hdr->caller = __builtin_return_address(0);
+#else
+	hdr->caller = nullptr;
+#endif
+	hdr->magic = hdr_magic(hdr);
+	return hdr + 1;
 }
 
-int __wrap_bfd_elf_get_obj_attr_int (void *abfd, int vendor, unsigned int tag){
-	return 0;
+static inline __attribute__((always_inline))
+void pool_insert(struct alloc_hdr *hdr){
+	pool_t& pool = pool_get(hdr->pool);
+	hdr->prev = nullptr;
+	hdr->next = pool.head;
+	if(pool.head != nullptr){
+		pool.head->prev = hdr;
+	}
+	pool.head = hdr;
+	pool.count++;
+	pool.bytes += hdr->size;
 }
 
-static void *tc_pseudo_table;
+static inline __attribute__((always_inline))
+void pool_remove(struct alloc_hdr *hdr){
+	pool_t& pool = pool_get(hdr->pool);
+	if(hdr->prev != nullptr){
+		hdr->prev->next = hdr->next;
+	} else {
+		pool.head = hdr->next;
+	}
+	if(hdr->next != nullptr){
+		hdr->next->prev = hdr->prev;
+	}
+	pool.count--;
+	pool.bytes -= hdr->size;
+}
 
-void __wrap_pop_insert (const void *table){
-	::tc_pseudo_table = const_cast<void *>(table);
+#ifdef ARGON_LIVE_REGION
+static inline __attribute__((always_inline))
+size_t region_align(size_t size){
+	return (size + (REGION_ALIGN - 1)) & ~(size_t)(REGION_ALIGN - 1);
 }
 
-void *argon_tc_pseudo_ops(){
-	return ::tc_pseudo_table;
+static struct region_chunk *region_chunk_new(size_t size){
+	auto chunk = static_cast<struct region_chunk *>(
+		__real_malloc(sizeof(struct region_chunk) + size));
+	if(chunk == nullptr){
+		return nullptr;
+	}
+	chunk->next = nullptr;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
 }
 
-/**
- * @brief Hook for the implementation of "set_section_contents"
- * "elf" because we're targeting the elf-linux backend for now
- **/
-bool __wrap__bfd_elf_set_section_contents (
-	void *abfd, asection *section,
-	const void *location,
-	uintptr_t offset,
-	uintptr_t count
-){
-	// skip non-code sections
-	if(strcmp(section->name, ".text") != 0){
-		return true;
+static void *region_alloc(size_t size){
+	size_t need = sizeof(struct alloc_hdr) + region_align(size);
+
+	struct region_chunk *chunk = region_cur;
+	while(chunk != nullptr && chunk->used + need > chunk->size){
+		// chunks past the current one are left over from a previous cycle
+		chunk = chunk->next;
+		if(chunk != nullptr){
+			chunk->used = 0;
+		}
+	}
+
+	if(chunk == nullptr){
+		chunk = region_chunk_new(std::max<size_t>(need, REGION_CHUNK_SIZE));
+		if(chunk == nullptr){
+			return nullptr;
+		}
+		if(region_head == nullptr){
+			region_head = chunk;
+		} else {
+			// append after the last retained chunk
+			struct region_chunk *tail = region_cur;
+			while(tail->next != nullptr) tail = tail->next;
+			tail->next = chunk;
+		}
 	}
+	region_cur = chunk;
 
-	off_t write_begin = bfd_data_count + offset;
-	if(write_begin >= bfd_data_size) return false;
+	auto hdr = reinterpret_cast<struct alloc_hdr *>(&chunk->data[chunk->used]);
+	chunk->used += need;
+	region_last = hdr;
+	live_pool.count++;
+	live_pool.bytes += size;
+	return hdr_init(hdr, size, ARGON_POOL_LIVE, ALLOC_REGION);
+}
 
-	off_t write_end = write_begin + count;
-	if(write_end >= bfd_data_size){
-		count -= (write_end - bfd_data_size);
+static void region_free(struct alloc_hdr *hdr){
+	live_pool.count--;
+	live_pool.bytes -= hdr->size;
+	if(hdr != region_last){
+		// reclaimed on the next GC
+		return;
 	}
-	std::memcpy(&::bfd_data[write_begin], location, count);
-	::bfd_data_count += count;
-	return true;
+	region_cur->used -= sizeof(struct alloc_hdr) + region_align(hdr->size);
+	region_last = nullptr;
 }
 
-/**
- * @brief Wrapper of realloc that stores succesful re-allocations
- * 
- * @param ptr 
- * @param size 
- * @return void* 
- */
-static void *hooked_realloc(void *ptr, size_t size){
-	bool track = !::in_malloc;
-	if(track){
-		::in_malloc = true;
-		pool_remove(ptr);
+static void *region_realloc(struct alloc_hdr *hdr, size_t size){
+	if(hdr == region_last){
+		size_t old_need = region_align(hdr->size);
+		size_t new_need = region_align(size);
+		if(region_cur->used - old_need + new_need <= region_cur->size){
+			// grow or shrink in place
+			region_cur->used = region_cur->used - old_need + new_need;
+			live_pool.bytes = live_pool.bytes - hdr->size + size;
+			hdr->size = size;
+			return hdr + 1;
+		}
 	}
-	ptr = __real_realloc(ptr, size);
-	if(ptr == nullptr){
+
+	void *mem = region_alloc(size);
+	if(mem == nullptr){
 		return nullptr;
 	}
-	if(track){
-		pool_insert(ptr, size);
-		::in_malloc = false;
-	}
-	return ptr;
+	std::memcpy(mem, hdr + 1, std::min(hdr->size, size));
+	live_pool.count--;
+	live_pool.bytes -= hdr->size;
+	return mem;
 }
 
-
 /**
- * @brief Wrapper of calloc that stores succesful allocations
+ * @brief Releases all the region allocations in one go
  * 
- * @param nmemb 
- * @param size 
- * @return void* 
+ * @param release if true, chunks are returned to the real allocator
  */
-static void *hooked_calloc(size_t nmemb, size_t size){
-	void *ptr = __real_calloc(nmemb, size);
-	if(ptr == nullptr){
-		return nullptr;
+static void region_reset(bool release){
+	if(release){
+		for(struct region_chunk *chunk = region_head; chunk != nullptr;){
+			struct region_chunk *next = chunk->next;
+			__real_free(chunk);
+			chunk = next;
+		}
+		region_head = nullptr;
+		region_mark = nullptr;
+	} else if(region_mark != nullptr){
+		// keep the checkpointed allocations
+		region_mark->used = region_mark_used;
+		region_cur = region_mark;
+		region_last = nullptr;
+		return;
+	} else if(region_head != nullptr){
+		region_head->used = 0;
 	}
+	region_cur = region_head;
+	region_last = nullptr;
+}
 
-	bool track = !::in_malloc;
-	if(track){
-		::in_malloc = true;
-		pool_insert(ptr, size);
-		::in_malloc = false;
+/**
+ * @brief Pins all the allocations currently in the region
+ */
+static void region_pin(){
+	for(struct region_chunk *chunk = region_head
+		;chunk != nullptr
+		;chunk = chunk->next
+	){
+		uint8_t *p = chunk->data;
+		while(p < &chunk->data[chunk->used]){
+			auto hdr = reinterpret_cast<struct alloc_hdr *>(p);
+			hdr->flags |= ALLOC_PINNED;
+			p += sizeof(struct alloc_hdr) + region_align(hdr->size);
+		}
+		if(chunk == region_cur) break;
 	}
-	return ptr;
+	region_mark = region_cur;
+	region_mark_used = (region_cur != nullptr) ? region_cur->used : 0;
+	region_last = nullptr;
 }
+#endif
 
+static uint8_t *bfd_data ARGON_PERSIST = nullptr;
+static size_t bfd_data_size ARGON_PERSIST = 0;
+static size_t bfd_data_count ARGON_PERSIST = 0;
+// position of bfd_data_count when the current write started
+static size_t bfd_data_base ARGON_PERSIST = 0;
 /**
- * @brief Wrapper of malloc that stores succesful allocations
- * 
- * @param size 
- * @return void* 
+ * address the bytes of bfd_data are executed from.
+ * same as bfd_data, unless the caller supplied a dual mapping (RW + RX view)
  */
-static void *hooked_malloc(size_t size){
-	void *ptr = __real_malloc(size);
-	if(ptr == nullptr){
-		return nullptr;
-	}
+static uint8_t *bfd_data_exec ARGON_PERSIST = nullptr;
 
-	bool track = !::in_malloc;
-	if(track){
-		::in_malloc = true;
-		pool_insert(ptr, size);
-		::in_malloc = false;
-	}
-	return ptr;
-}
+enum bfd_data_kind {
+	// fixed size, argon_bfd_data_alloc
+	BFD_DATA_MALLOC,
+	// grows on demand, argon_bfd_data_alloc_growable
+	BFD_DATA_GROWABLE,
+	// owned by the caller, argon_bfd_data_set_buffer
+	BFD_DATA_USER
+};
+static int bfd_data_kind ARGON_PERSIST = BFD_DATA_MALLOC;
+// end of the last write. larger than bfd_data_size if it didn't fit
+static size_t bfd_data_required ARGON_PERSIST = 0;
+static argon_overflow_fn bfd_data_overflow_fn ARGON_PERSIST = nullptr;
+static void *bfd_data_overflow_opaque ARGON_PERSIST = nullptr;
+/**
+ * address bfd_data is placed at (argon_bfd_data_set_vma).
+ * when set, references to .text and to absolute addresses
+ * are resolved while .text is written
+ */
+static bool bfd_data_vma_set ARGON_PERSIST = false;
+static uint64_t bfd_data_vma ARGON_PERSIST = 0;
 
-static void hooked_free(void *ptr){
-	bool track = !::in_malloc;
-	if(track){
-		::in_malloc = true;
-		pool_t& pool = pool_get();
-		if(pool.find(ptr) != pool.end()){
-			pool.erase(ptr);
-			__real_free(ptr);
-		}
-		::in_malloc = false;
-	} else {
-		__real_free(ptr);
+#define GROWABLE_PAGE_SIZE 4096
+
+/**
+ * .text is written to bfd_data, at the current position.
+ * any other section gets its own growable buffer, reused across writes.
+ * the table lists the sections written by the last write_object_file
+ */
+#define MAX_OUTPUT_SECTIONS 32
+
+struct out_section {
+	char *name;
+	unsigned flags;
+	unsigned alignment;
+	// NULL for .text (lives in bfd_data)
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static struct out_section out_sections[MAX_OUTPUT_SECTIONS] ARGON_PERSIST;
+static size_t out_nsections ARGON_PERSIST = 0;
+// sections written by the current pass, in order
+static struct out_section *out_active[MAX_OUTPUT_SECTIONS] ARGON_PERSIST;
+static size_t out_nactive ARGON_PERSIST = 0;
+
+/**
+ * symbols and relocations of the last write.
+ * names are copied to out_strtab and referenced by offset,
+ * since the table can move when it grows
+ */
+struct out_symbol {
+	size_t name;
+	size_t section;
+	uint64_t value;
+	unsigned flags;
+};
+
+struct out_fixup {
+	size_t section;
+	size_t symbol;
+	size_t type_name;
+	uint64_t offset;
+	int64_t addend;
+	unsigned size;
+	unsigned type;
+	bool pc_relative;
+	// static table entry, valid for the lifetime of the library
+	reloc_howto_type *howto;
+};
+
+static char *out_strtab ARGON_PERSIST = nullptr;
+static size_t out_strtab_size ARGON_PERSIST = 0;
+static size_t out_strtab_capacity ARGON_PERSIST = 0;
+
+static struct out_symbol *out_symbols ARGON_PERSIST = nullptr;
+static size_t out_nsymbols ARGON_PERSIST = 0;
+static size_t out_symbols_capacity ARGON_PERSIST = 0;
+
+static struct out_fixup *out_fixups ARGON_PERSIST = nullptr;
+static size_t out_nfixups ARGON_PERSIST = 0;
+static size_t out_fixups_capacity ARGON_PERSIST = 0;
+
+// relocations of .text resolved against bfd_data_vma, applied by out_write
+struct out_resolved {
+	uint64_t offset;
+	bfd_vma value;
+	reloc_howto_type *howto;
+};
+
+static struct out_resolved *out_resolved ARGON_PERSIST = nullptr;
+static size_t out_nresolved ARGON_PERSIST = 0;
+static size_t out_resolved_capacity ARGON_PERSIST = 0;
+// relocations that couldn't be resolved, the target being out of range
+static size_t out_noverflow ARGON_PERSIST = 0;
+
+#define OUT_STRTAB_NONE SIZE_MAX
+
+/**
+ * @brief Makes room for at least "count" elements in a table
+ */
+static bool out_table_reserve(void **table, size_t *capacity, size_t count, size_t elem_size){
+	if(count <= *capacity){
+		return true;
+	}
+	size_t new_capacity = std::max<size_t>(*capacity * 2, 16);
+	new_capacity = std::max(new_capacity, count);
+	void *mem = __real_realloc(*table, new_capacity * elem_size);
+	if(mem == nullptr){
+		return false;
 	}
+	*table = mem;
+	*capacity = new_capacity;
+	return true;
 }
 
-void argon_gcpool_set(int pool_selector){
-	::g_pool_selector = pool_selector;
+static size_t out_strtab_add(const char *str){
+	if(str == nullptr){
+		return OUT_STRTAB_NONE;
+	}
+	size_t size = strlen(str) + 1;
+	if(!out_table_reserve(
+		reinterpret_cast<void **>(&::out_strtab), &::out_strtab_capacity,
+		::out_strtab_size + size, 1)
+	){
+		return OUT_STRTAB_NONE;
+	}
+	size_t offset = ::out_strtab_size;
+	std::memcpy(&::out_strtab[offset], str, size);
+	::out_strtab_size += size;
+	return offset;
 }
 
-static void pool_clear(pool_t &pool){
-	for(auto const& item : pool){
-	#ifdef DEBUG
-		void *ptr = item.first;
-		struct alloc_info caller = item.second;
-		printf(">> gc free %p (%p -> %p -> %p -> %p -> %p)\n", ptr,
-			caller.bt[0], caller.bt[1], caller.bt[2],
-			caller.bt[3], caller.bt[4]);
-	#else
-		void *ptr = item;
-	#endif
-		__real_free(ptr);
-	}
-	pool.clear();
+static const char *out_strtab_get(size_t offset){
+	return (offset == OUT_STRTAB_NONE) ? nullptr : &::out_strtab[offset];
 }
 
 /**
- * @brief Frees all the memory allocations that haven't been freed 
+ * relocatable object output (ARGON_OBJECT_OUTPUT):
+ * the output BFD is a real ELF object, written to a growable buffer
+ * through its own iovec. the ELF hooks let BFD do the work for it
  */
-void argon_malloc_gc(int pool_selector){
-	/*
-	printf("init_pool: %d, live_pool: %d\n",
-		init_pool.size(),
-		live_pool.size());
-	*/
 
-	if(HAS_FLAG(pool_selector, ARGON_POOL_LIVE)){
-		pool_clear(live_pool);
+// layout of struct bfd_iovec (libbfd.h, binutils 2.38)
+struct object_iovec {
+	file_ptr (*bread)(bfd *abfd, void *ptr, file_ptr nbytes);
+	file_ptr (*bwrite)(bfd *abfd, const void *ptr, file_ptr nbytes);
+	file_ptr (*btell)(bfd *abfd);
+	int (*bseek)(bfd *abfd, file_ptr offset, int whence);
+	int (*bclose)(bfd *abfd);
+	int (*bflush)(bfd *abfd);
+	int (*bstat)(bfd *abfd, struct stat *sb);
+	void *(*bmmap)(bfd *abfd, void *addr, bfd_size_type len,
+		int prot, int flags, file_ptr offset,
+		void **map_addr, bfd_size_type *map_len);
+};
+
+struct object_output {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+	size_t pos;
+};
+
+// malloc'd outside of the GC pools: it's handed over to the caller
+static struct object_output object_out ARGON_PERSIST;
+
+static bool object_reserve(struct object_output *out, size_t size){
+	if(size <= out->capacity){
+		return true;
 	}
-	if(HAS_FLAG(pool_selector, ARGON_POOL_INIT)){
-		pool_clear(init_pool);
+	size_t capacity = std::max<size_t>(out->capacity * 2, GROWABLE_PAGE_SIZE);
+	capacity = std::max(capacity, size);
+	void *mem = __real_realloc(out->data, capacity);
+	if(mem == nullptr){
+		return false;
 	}
+	out->data = static_cast<uint8_t *>(mem);
+	out->capacity = capacity;
+	return true;
 }
 
-void *argon_bfd_data_alloc(size_t size){
-	// allocate through the real malloc
-	::bfd_data = static_cast<uint8_t *>(__real_malloc(size));
-	if(bfd_data != nullptr){
-		::bfd_data_size = size;
+static file_ptr object_bread(bfd *abfd, void *ptr, file_ptr nbytes){
+	auto out = static_cast<struct object_output *>(abfd->iostream);
+	if(out->pos >= out->size){
+		return 0;
 	}
-	::bfd_data_count = 0;
-	return ::bfd_data;
+	size_t count = std::min<size_t>(nbytes, out->size - out->pos);
+	std::memcpy(ptr, &out->data[out->pos], count);
+	out->pos += count;
+	return count;
 }
 
-size_t argon_bfd_data_written(){
-	return ::bfd_data_count;
+static file_ptr object_bwrite(bfd *abfd, const void *ptr, file_ptr nbytes){
+	auto out = static_cast<struct object_output *>(abfd->iostream);
+	size_t end = out->pos + nbytes;
+	if(!object_reserve(out, end)){
+		return -1;
+	}
+	if(out->pos > out->size){
+		// seeked past the end: fill the gap
+		std::memset(&out->data[out->size], 0x00, out->pos - out->size);
+	}
+	std::memcpy(&out->data[out->pos], ptr, nbytes);
+	out->pos = end;
+	out->size = std::max(out->size, end);
+	return nbytes;
 }
 
-void argon_fseek(long offset, int whence){
-	size_t p = ::bfd_data_count;
+static file_ptr object_btell(bfd *abfd){
+	return static_cast<struct object_output *>(abfd->iostream)->pos;
+}
+
+static int object_bseek(bfd *abfd, file_ptr offset, int whence){
+	auto out = static_cast<struct object_output *>(abfd->iostream);
+	file_ptr pos = offset;
 	switch(whence){
-		case SEEK_SET:
-			p = offset;
+		case SEEK_CUR:
+			pos += out->pos;
 			break;
 		case SEEK_END:
-			p += ::bfd_data_size + offset;
-			break;
-		case SEEK_CUR:
-			p += offset;
+			pos += out->size;
 			break;
 	}
-	::bfd_data_count = p;
+	if(pos < 0){
+		return -1;
+	}
+	out->pos = pos;
+	return 0;
 }
 
-#define FAKE_OUTPUT_HANDLE (FILE *)(-2)
+static int object_bclose(bfd *abfd){
+	// the data is kept for argon_bfd_object_take
+	abfd->iostream = nullptr;
+	return 0;
+}
 
-extern int __real_fclose(FILE *stream);
-int __wrap_fclose(FILE *stream){
-	if(stream == FAKE_OUTPUT_HANDLE){
-		return 0;
+static int object_bflush(bfd *abfd){
+	(void)abfd;
+	return 0;
+}
+
+static int object_bstat(bfd *abfd, struct stat *sb){
+	std::memset(sb, 0x00, sizeof(*sb));
+	sb->st_size = static_cast<struct object_output *>(abfd->iostream)->size;
+	return 0;
+}
+
+static void *object_bmmap(bfd *abfd, void *addr, bfd_size_type len,
+	int prot, int flags, file_ptr offset,
+	void **map_addr, bfd_size_type *map_len
+){
+	(void)abfd; (void)addr; (void)len; (void)prot;
+	(void)flags; (void)offset; (void)map_addr; (void)map_len;
+	return reinterpret_cast<void *>(-1);
+}
+
+static const struct object_iovec object_iovec = {
+	&object_bread, &object_bwrite, &object_btell, &object_bseek,
+	&object_bclose, &object_bflush, &object_bstat, &object_bmmap
+};
+
+/**
+ * @brief Tells if the BFD writes to memory (see argon_bfd_object_attach)
+ */
+bool is_object_bfd(void *abfd){
+	return abfd != nullptr
+		&& static_cast<bfd *>(abfd)->iovec == reinterpret_cast<const struct bfd_iovec *>(&object_iovec);
+}
+
+/**
+ * @brief Redirects the output of a BFD opened for writing to memory
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int argon_bfd_object_attach(bfd *abfd){
+	// drop the (fake) file handle, and the BFD from the file cache
+	if(!bfd_cache_close(abfd)){
+		return -1;
 	}
-	return __real_fclose(stream);
+#ifdef BFD_CLOSED_BY_CACHE
+	abfd->flags &= ~BFD_CLOSED_BY_CACHE;
+#endif
+	// not claimed by the previous object
+	__real_free(::object_out.data);
+	std::memset(&::object_out, 0x00, sizeof(::object_out));
+
+	abfd->iovec = reinterpret_cast<const struct bfd_iovec *>(&object_iovec);
+	abfd->iostream = &::object_out;
+	return 0;
 }
 
-FILE *__wrap__bfd_real_fopen (const char *filename, const char *modes){
-	(void)filename;
-	(void)modes;
-	return FAKE_OUTPUT_HANDLE;
+/**
+ * @brief Hands the object written by the last bfd_close over to the caller
+ * 
+ * @param[out] size size of the object
+ * @return the object, to be released with argon_free (NULL if none)
+ */
+void *argon_bfd_object_take(size_t *size){
+	void *data = ::object_out.data;
+	*size = ::object_out.size;
+	std::memset(&::object_out, 0x00, sizeof(::object_out));
+	return data;
+}
+
+/**
+ * these hooks are needed to avoid a crash
+ * since we are working on an uninitialized ELF file 
+ */
+extern uintptr_t __real_bfd_elf_obj_attr_size (void *abfd);
+uintptr_t __wrap_bfd_elf_obj_attr_size (void *abfd){
+	if(is_object_bfd(abfd)){
+		return __real_bfd_elf_obj_attr_size(abfd);
+	}
+	return 0;
+}
+
+/**
+ * @brief Hook for bfd_set_symtab.
+ * The symbol table isn't written to a file, we just keep a copy for
+ * argon_bfd_data_symbol_get
+ */
+extern bool __real_bfd_set_symtab (void *abfd, asymbol **location, unsigned int symcount);
+bool __wrap_bfd_set_symtab (void *abfd, asymbol **location, unsigned int symcount){
+	if(is_object_bfd(abfd) && !__real_bfd_set_symtab(abfd, location, symcount)){
+		return false;
+	}
+	if(!out_table_reserve(
+		reinterpret_cast<void **>(&::out_symbols), &::out_symbols_capacity,
+		::out_nsymbols + symcount, sizeof(struct out_symbol))
+	){
+		return false;
+	}
+	for(unsigned i=0; i<symcount; i++){
+		asymbol *sym = location[i];
+		struct out_symbol *out = &::out_symbols[::out_nsymbols++];
+		out->name = out_strtab_add(sym->name);
+		out->section = out_strtab_add(sym->section->name);
+		out->value = sym->value;
+		out->flags = sym->flags;
+	}
+	return true;
+}
+
+/**
+ * @brief Checks that a value fits a relocated field, as
+ * _bfd_relocate_contents would (low bits dropped by rightshift included)
+ */
+static bool out_value_fits(reloc_howto_type *howto, bfd_vma value){
+	if(howto->rightshift > 0 && (value & (((bfd_vma)1 << howto->rightshift) - 1)) != 0){
+		return false;
+	}
+	unsigned bits = howto->bitsize;
+	if(bits == 0 || bits >= 64){
+		return true;
+	}
+	bfd_signed_vma top = static_cast<bfd_signed_vma>(value) >> (howto->rightshift + bits - 1);
+	bool fits_signed = (top == 0 || top == -1);
+	bool fits_unsigned = ((value >> howto->rightshift) >> bits) == 0;
+	switch(howto->complain_on_overflow){
+		case complain_overflow_signed: return fits_signed;
+		case complain_overflow_unsigned: return fits_unsigned;
+		// either sign or zero extended
+		default: return fits_signed || fits_unsigned;
+	}
+}
+
+/**
+ * @brief Resolves a relocation of .text against bfd_data_vma, if possible:
+ * the target must be in .text or absolute, and in range of the field
+ * 
+ * @return true if the relocation was resolved
+ */
+static bool out_resolve(sec_ptr section, arelent *rel){
+	// objects keep their relocations
+	if(!::bfd_data_vma_set || is_object_bfd(stdoutput)
+	|| strcmp(section->name, ".text") != 0
+	|| rel->sym_ptr_ptr == nullptr || *rel->sym_ptr_ptr == nullptr
+	){
+		return false;
+	}
+
+	asymbol *sym = *rel->sym_ptr_ptr;
+	// address of the .text of this write
+	bfd_vma text_vma = ::bfd_data_vma + ::bfd_data_base;
+	bfd_vma value;
+	if(bfd_is_abs_section(sym->section)){
+		value = sym->value;
+	} else if(sym->section == section){
+		value = text_vma + sym->value;
+	} else {
+		return false;
+	}
+	value += rel->addend;
+	if(rel->howto->pc_relative){
+		value -= text_vma + rel->address;
+	}
+	if(!out_value_fits(rel->howto, value)){
+		// e.g. "call 0x401000" from a high address: left to the caller as a fixup
+		fprintf(stderr, "argon: relocation %s overflow at .text+0x%llx, left unresolved\n",
+			rel->howto->name, static_cast<unsigned long long>(rel->address));
+		::out_noverflow++;
+		return false;
+	}
+
+	if(!out_table_reserve(
+		reinterpret_cast<void **>(&::out_resolved), &::out_resolved_capacity,
+		::out_nresolved + 1, sizeof(struct out_resolved))
+	){
+		return false;
+	}
+	struct out_resolved *out = &::out_resolved[::out_nresolved++];
+	out->offset = rel->address;
+	out->value = value;
+	out->howto = rel->howto;
+	return true;
+}
+
+/**
+ * @brief Applies the resolved relocations that fall in a write to .text
+ * 
+ * @param begin start of the write, relative to .text
+ * @param end end of the write, relative to .text
+ */
+static void out_apply_resolved(size_t begin, size_t end){
+	for(size_t i=0; i<::out_nresolved; i++){
+		struct out_resolved *r = &::out_resolved[i];
+		size_t size = bfd_get_reloc_size(r->howto);
+		if(r->offset < begin || r->offset + size > end){
+			continue;
+		}
+		bfd_reloc_status_type status = _bfd_relocate_contents(
+			r->howto, static_cast<bfd *>(stdoutput), r->value,
+			&::bfd_data[::bfd_data_base + r->offset]);
+		if(status != bfd_reloc_ok){
+			fprintf(stderr, "argon: relocation %s overflow at .text+0x%llx\n",
+				r->howto->name, static_cast<unsigned long long>(r->offset));
+		}
+	}
+}
+
+/**
+ * @brief Hook for bfd_set_reloc.
+ * Called by write_relocs with the fixups that survived relaxation
+ * (i.e. that couldn't be resolved by GAS)
+ */
+extern void __real__bfd_generic_set_reloc(bfd *abfd, sec_ptr section, arelent **relocation, unsigned int count);
+void __wrap__bfd_generic_set_reloc(bfd *abfd, sec_ptr section, arelent **relocation, unsigned int count){
+	if(out_table_reserve(
+		reinterpret_cast<void **>(&::out_fixups), &::out_fixups_capacity,
+		::out_nfixups + count, sizeof(struct out_fixup))
+	){
+		size_t section_name = out_strtab_add(section->name);
+		for(unsigned i=0; i<count; i++){
+			arelent *rel = relocation[i];
+			if(out_resolve(section, rel)){
+				continue;
+			}
+			struct out_fixup *out = &::out_fixups[::out_nfixups++];
+			out->section = section_name;
+			out->symbol = (rel->sym_ptr_ptr != nullptr && *rel->sym_ptr_ptr != nullptr)
+				? out_strtab_add((*rel->sym_ptr_ptr)->name)
+				: OUT_STRTAB_NONE;
+			out->type_name = out_strtab_add(rel->howto->name);
+			out->offset = rel->address;
+			out->addend = rel->addend;
+			out->size = bfd_get_reloc_size(rel->howto);
+			out->type = rel->howto->type;
+			out->pc_relative = rel->howto->pc_relative;
+			out->howto = rel->howto;
+		}
+	}
+	__real__bfd_generic_set_reloc(abfd, section, relocation, count);
+}
+
+extern int __real_bfd_elf_get_obj_attr_int (void *abfd, int vendor, unsigned int tag);
+int __wrap_bfd_elf_get_obj_attr_int (void *abfd, int vendor, unsigned int tag){
+	if(is_object_bfd(abfd)){
+		return __real_bfd_elf_get_obj_attr_int(abfd, vendor, tag);
+	}
+	return 0;
+}
+
+static void *tc_pseudo_table;
+
+void __wrap_pop_insert (const void *table){
+	::tc_pseudo_table = const_cast<void *>(table);
+}
+
+void *argon_tc_pseudo_ops(){
+	return ::tc_pseudo_table;
+}
+
+static struct out_section *out_section_get(const char *section_name, unsigned flags, unsigned alignment){
+	for(size_t i=0; i<out_nactive; i++){
+		if(!strcmp(out_active[i]->name, section_name)){
+			return out_active[i];
+		}
+	}
+	if(out_nactive >= MAX_OUTPUT_SECTIONS){
+		return nullptr;
+	}
+
+	struct out_section *out = nullptr;
+	for(size_t i=0; i<out_nsections; i++){
+		if(!strcmp(out_sections[i].name, section_name)){
+			out = &out_sections[i];
+			break;
+		}
+	}
+	if(out == nullptr){
+		if(out_nsections >= MAX_OUTPUT_SECTIONS){
+			return nullptr;
+		}
+		size_t name_size = strlen(section_name) + 1;
+		char *name = static_cast<char *>(__real_malloc(name_size));
+		if(name == nullptr){
+			return nullptr;
+		}
+		std::memcpy(name, section_name, name_size);
+
+		out = &out_sections[out_nsections++];
+		out->name = name;
+		out->data = nullptr;
+		out->capacity = 0;
+	}
+
+	out->flags = flags;
+	out->alignment = alignment;
+	out->size = 0;
+	out_active[out_nactive++] = out;
+	return out;
+}
+
+static bool out_section_write(struct out_section *out, const void *location, size_t offset, size_t count){
+	size_t write_end = offset + count;
+	if(write_end > out->capacity){
+		size_t capacity = std::max<size_t>(out->capacity * 2, 256);
+		capacity = std::max(capacity, write_end);
+		auto data = static_cast<uint8_t *>(__real_realloc(out->data, capacity));
+		if(data == nullptr){
+			return false;
+		}
+		out->data = data;
+		out->capacity = capacity;
+	}
+	std::memcpy(&out->data[offset], location, count);
+	out->size = std::max(out->size, write_end);
+	return true;
+}
+
+static uint8_t *growable_map(uint8_t *mem, size_t old_size, size_t new_size){
+#if defined(WIN32)
+	(void)old_size;
+	return static_cast<uint8_t *>(__real_realloc(mem, new_size));
+#else
+	void *new_mem;
+#ifdef __linux__
+	if(mem != nullptr){
+		new_mem = mremap(mem, old_size, new_size, MREMAP_MAYMOVE);
+		return (new_mem == MAP_FAILED) ? nullptr : static_cast<uint8_t *>(new_mem);
+	}
+#endif
+	new_mem = mmap(nullptr, new_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(new_mem == MAP_FAILED){
+		return nullptr;
+	}
+	if(mem != nullptr){
+		std::memcpy(new_mem, mem, std::min(old_size, new_size));
+		munmap(mem, old_size);
+	}
+	return static_cast<uint8_t *>(new_mem);
+#endif
+}
+
+static void growable_unmap(uint8_t *mem, size_t size){
+#if defined(WIN32)
+	(void)size;
+	__real_free(mem);
+#else
+	munmap(mem, size);
+#endif
+}
+
+/**
+ * @brief Makes the growable buffer at least "required" bytes large
+ * 
+ * @return false if the buffer can't grow
+ */
+static bool bfd_data_grow(size_t required){
+	if(::bfd_data_kind != BFD_DATA_GROWABLE){
+		return false;
+	}
+	// geometric growth, so that large outputs take few remaps
+	size_t size = std::max(::bfd_data_size * 2, required);
+	size = (size + GROWABLE_PAGE_SIZE - 1) & ~(size_t)(GROWABLE_PAGE_SIZE - 1);
+
+	uint8_t *mem = growable_map(::bfd_data, ::bfd_data_size, size);
+	if(mem == nullptr){
+		return false;
+	}
+	::bfd_data = mem;
+	::bfd_data_exec = mem;
+	::bfd_data_size = size;
+	return true;
+}
+
+static bool out_write(struct out_section *out, const void *location, size_t offset, size_t count);
+
+/**
+ * @brief Hook for the implementation of "set_section_contents"
+ * "elf" because we're targeting the elf-linux backend for now
+ **/
+extern bool __real__bfd_elf_set_section_contents (
+	void *abfd, asection *section,
+	const void *location,
+	uintptr_t offset,
+	uintptr_t count);
+bool __wrap__bfd_elf_set_section_contents (
+	void *abfd, asection *section,
+	const void *location,
+	uintptr_t offset,
+	uintptr_t count
+){
+	if(is_object_bfd(abfd)){
+		return __real__bfd_elf_set_section_contents(abfd, section, location, offset, count);
+	}
+	struct out_section *out = out_section_get(
+		section->name, section->flags, section->alignment_power);
+	if(out == nullptr){
+		return false;
+	}
+	return out_write(out, location, offset, count);
+}
+
+/**
+ * @brief Writes to an output section: .text goes to bfd_data,
+ * everything else to the section buffers
+ */
+static bool out_write(struct out_section *out, const void *location, size_t offset, size_t count){
+	if(strcmp(out->name, ".text") != 0){
+		return out_section_write(out, location, offset, count);
+	}
+
+	size_t write_begin = bfd_data_base + offset;
+	size_t write_end = write_begin + count;
+	::bfd_data_required = std::max(::bfd_data_required, write_end);
+
+	if(write_end > ::bfd_data_size && !bfd_data_grow(write_end)){
+		if(::bfd_data_overflow_fn != nullptr){
+			::bfd_data_overflow_fn(write_end, ::bfd_data_size, ::bfd_data_overflow_opaque);
+		}
+		/**
+		 * keep what fits: failing the write would make GAS abort.
+		 * the caller can tell from argon_bfd_data_required()
+		 */
+		write_end = ::bfd_data_size;
+		write_begin = std::min(write_begin, write_end);
+		count = write_end - write_begin;
+	}
+	std::memcpy(&::bfd_data[write_begin], location, count);
+	if(::out_nresolved > 0){
+		out_apply_resolved(write_begin - bfd_data_base, write_end - bfd_data_base);
+	}
+	if(::bfd_data_kind == BFD_DATA_USER){
+		// the code might be executed right away
+		__builtin___clear_cache(
+			reinterpret_cast<char *>(&::bfd_data_exec[write_begin]),
+			reinterpret_cast<char *>(&::bfd_data_exec[write_begin + count]));
+	}
+	::bfd_data_count = std::max(::bfd_data_count, write_end);
+	out->size = ::bfd_data_count - bfd_data_base;
+	return true;
+}
+
+/**
+ * @brief Allocates a tagged block in the selected pool
+ * 
+ * @param size 
+ * @param zero clear the memory, like calloc
+ * @return void* 
+ */
+static void *pool_alloc(size_t size, bool zero){
+#ifdef ARGON_LIVE_REGION
+	if(::g_pool_selector == ARGON_POOL_LIVE){
+		void *mem = region_alloc(size);
+		// chunks are recycled, so the memory has to be cleared
+		if(zero && mem != nullptr){
+			std::memset(mem, 0x00, size);
+		}
+		return mem;
+	}
+#endif
+	size_t total = sizeof(struct alloc_hdr) + size;
+	auto hdr = static_cast<struct alloc_hdr *>(zero
+		? __real_calloc(1, total)
+		: __real_malloc(total));
+	if(hdr == nullptr){
+		return nullptr;
+	}
+	void *mem = hdr_init(hdr, size, ::g_pool_selector, 0);
+	pool_insert(hdr);
+	return mem;
+}
+
+/**
+ * @brief Wrapper of realloc that keeps the block in its pool
+ * 
+ * @param ptr 
+ * @param size 
+ * @return void* 
+ */
+static void *hooked_realloc(void *ptr, size_t size){
+	if(ptr == nullptr){
+		return pool_alloc(size, false);
+	}
+
+	struct alloc_hdr *hdr = hdr_find(ptr);
+	if(hdr == nullptr){
+		// not ours, leave it untracked
+		return __real_realloc(ptr, size);
+	}
+
+	if(HAS_FLAG(hdr->flags, ALLOC_PINNED)){
+		// the checkpointed copy must stay where it is
+		void *mem = pool_alloc(size, false);
+		if(mem != nullptr){
+			std::memcpy(mem, ptr, std::min(hdr->size, size));
+		}
+		return mem;
+	}
+
+#ifdef ARGON_LIVE_REGION
+	if(HAS_FLAG(hdr->flags, ALLOC_REGION)){
+		if(::g_pool_selector == ARGON_POOL_LIVE){
+			return region_realloc(hdr, size);
+		}
+		// the allocation is moving out of the region, into the selected pool
+		void *mem = pool_alloc(size, false);
+		if(mem != nullptr){
+			std::memcpy(mem, ptr, std::min(hdr->size, size));
+			region_free(hdr);
+		}
+		return mem;
+	}
+#endif
+
+	pool_remove(hdr);
+	auto new_hdr = static_cast<struct alloc_hdr *>(
+		__real_realloc(hdr, sizeof(struct alloc_hdr) + size));
+	if(new_hdr == nullptr){
+		// the original block is still valid
+		pool_insert(hdr);
+		return nullptr;
+	}
+	// the block might have moved: refresh the header
+	void *mem = hdr_init(new_hdr, size, new_hdr->pool, new_hdr->flags);
+	pool_insert(new_hdr);
+	return mem;
+}
+
+/**
+ * @brief Wrapper of calloc that stores succesful allocations
+ * 
+ * @param nmemb 
+ * @param size 
+ * @return void* 
+ */
+static void *hooked_calloc(size_t nmemb, size_t size){
+	size_t total;
+	if(__builtin_mul_overflow(nmemb, size, &total)){
+		return nullptr;
+	}
+	return pool_alloc(total, true);
+}
+
+/**
+ * @brief Wrapper of malloc that stores succesful allocations
+ * 
+ * @param size 
+ * @return void* 
+ */
+static void *hooked_malloc(size_t size){
+	return pool_alloc(size, false);
+}
+
+static void hooked_free(void *ptr){
+	struct alloc_hdr *hdr = hdr_find(ptr);
+	if(hdr == nullptr){
+		__real_free(ptr);
+		return;
+	}
+	if(HAS_FLAG(hdr->flags, ALLOC_PINNED)){
+		// restored by argon_gc_restore
+		return;
+	}
+#ifdef ARGON_LIVE_REGION
+	if(HAS_FLAG(hdr->flags, ALLOC_REGION)){
+		region_free(hdr);
+		return;
+	}
+#endif
+	pool_remove(hdr);
+	// make sure a double free can't match again
+	hdr->magic = 0;
+	__real_free(hdr);
+}
+
+void argon_gcpool_set(int pool_selector){
+	::g_pool_selector = pool_selector;
+}
+
+int argon_gcpool_get(){
+	return ::g_pool_selector;
+}
+
+static void pool_clear(pool_t &pool){
+	for(struct alloc_hdr *hdr = pool.head; hdr != nullptr;){
+		struct alloc_hdr *next = hdr->next;
+	#ifdef DEBUG
+		printf(">> gc free %p (%zu bytes, from %p)\n", hdr + 1,
+			hdr->size, hdr->caller);
+	#endif
+		hdr->magic = 0;
+		__real_free(hdr);
+		hdr = next;
+	}
+	pool.head = nullptr;
+	pool.count = 0;
+	pool.bytes = 0;
+}
+
+/**
+ * @brief Frees all the memory allocations that haven't been freed 
+ */
+void argon_malloc_gc(int pool_selector){
+	/*
+	printf("init_pool: %zu (%zu bytes), live_pool: %zu (%zu bytes)\n",
+		init_pool.count, init_pool.bytes,
+		live_pool.count, live_pool.bytes);
+	*/
+
+	if(HAS_FLAG(pool_selector, ARGON_POOL_INIT)){
+		// the checkpoint references the init pool
+		argon_gc_checkpoint_drop();
+	}
+	if(HAS_FLAG(pool_selector, ARGON_POOL_LIVE)){
+		pool_clear(live_pool);
+	#ifdef ARGON_LIVE_REGION
+		// on a full reset, give the chunks back as well
+		region_reset(HAS_FLAG(pool_selector, ARGON_POOL_INIT));
+	#endif
+	}
+	if(HAS_FLAG(pool_selector, ARGON_POOL_INIT)){
+		pool_clear(init_pool);
+	}
+}
+
+/**
+ * @brief Moves all the blocks of a pool into the pinned pool
+ */
+static void pool_pin(pool_t &pool){
+	for(struct alloc_hdr *hdr = pool.head; hdr != nullptr;){
+		struct alloc_hdr *next = hdr->next;
+		hdr->pool = POOL_PINNED;
+		hdr->flags |= ALLOC_PINNED;
+		pool_insert(hdr);
+		hdr = next;
+	}
+	pool.head = nullptr;
+	pool.count = 0;
+	pool.bytes = 0;
+}
+
+/**
+ * @brief Pins every allocation made so far and saves its contents.
+ * Blocks allocated after this point are released by argon_gc_restore
+ * 
+ * @return 0 on success, -1 on allocation failure
+ */
+int argon_gc_checkpoint(){
+	/**
+	 * size the copy before pinning anything,
+	 * so that a failed allocation leaves the pools untouched.
+	 * region blocks are accounted in live_pool but aren't in its list,
+	 * so the lists are walked instead of trusting the counters
+	 */
+	size_t nranges = 0;
+	size_t image_size = 0;
+	for(pool_t *pool : {&init_pool, &live_pool, &pinned_pool}){
+		for(struct alloc_hdr *hdr = pool->head; hdr != nullptr; hdr = hdr->next){
+			nranges++;
+			image_size += hdr->size;
+		}
+	}
+#ifdef ARGON_LIVE_REGION
+	for(struct region_chunk *chunk = region_head
+		;chunk != nullptr
+		;chunk = chunk->next
+	){
+		nranges++;
+		image_size += chunk->used;
+		if(chunk == region_cur) break;
+	}
+#endif
+
+	auto ranges = static_cast<struct pin_range *>(
+		__real_malloc(std::max<size_t>(nranges, 1) * sizeof(struct pin_range)));
+	if(ranges == nullptr){
+		return -1;
+	}
+	auto image = static_cast<uint8_t *>(__real_malloc(std::max<size_t>(image_size, 1)));
+	if(image == nullptr){
+		__real_free(ranges);
+		return -1;
+	}
+
+	pool_pin(init_pool);
+	pool_pin(live_pool);
+#ifdef ARGON_LIVE_REGION
+	region_pin();
+#endif
+
+	size_t n = 0;
+	for(struct alloc_hdr *hdr = pinned_pool.head; hdr != nullptr; hdr = hdr->next){
+		ranges[n].start = reinterpret_cast<uint8_t *>(hdr + 1);
+		ranges[n].size = hdr->size;
+		n++;
+	}
+#ifdef ARGON_LIVE_REGION
+	for(struct region_chunk *chunk = region_head
+		;chunk != nullptr
+		;chunk = chunk->next
+	){
+		ranges[n].start = chunk->data;
+		ranges[n].size = chunk->used;
+		n++;
+		if(chunk == region_mark) break;
+	}
+#endif
+
+	uint8_t *p = image;
+	for(size_t i=0; i<n; i++){
+		std::memcpy(p, ranges[i].start, ranges[i].size);
+		p += ranges[i].size;
+	}
+
+	__real_free(::pin_ranges);
+	__real_free(::pin_image);
+	::pin_ranges = ranges;
+	::pin_nranges = n;
+	::pin_image = image;
+	::pin_valid = true;
+	return 0;
+}
+
+/**
+ * @brief Releases everything allocated after the checkpoint,
+ * and brings the pinned blocks back to their checkpointed contents
+ * 
+ * @return 0 on success, -1 if there is no checkpoint
+ */
+int argon_gc_restore(){
+	if(!::pin_valid){
+		return -1;
+	}
+	pool_clear(live_pool);
+	pool_clear(init_pool);
+#ifdef ARGON_LIVE_REGION
+	region_reset(false);
+#endif
+
+	const uint8_t *p = ::pin_image;
+	for(size_t i=0; i<::pin_nranges; i++){
+		std::memcpy(::pin_ranges[i].start, p, ::pin_ranges[i].size);
+		p += ::pin_ranges[i].size;
+	}
+	return 0;
+}
+
+/**
+ * @brief Forgets the checkpoint and releases the pinned blocks
+ */
+void argon_gc_checkpoint_drop(){
+	if(!::pin_valid){
+		return;
+	}
+	pool_clear(pinned_pool);
+	__real_free(::pin_ranges);
+	__real_free(::pin_image);
+	::pin_ranges = nullptr;
+	::pin_nranges = 0;
+	::pin_image = nullptr;
+	::pin_valid = false;
+#ifdef ARGON_LIVE_REGION
+	region_mark = nullptr;
+	region_mark_used = 0;
+#endif
+}
+
+/**
+ * @brief Returns the number of bytes currently owned by the given pools
+ */
+size_t argon_gc_pool_size(int pool_selector){
+	size_t bytes = 0;
+	if(HAS_FLAG(pool_selector, ARGON_POOL_LIVE)){
+		bytes += live_pool.bytes;
+	}
+	if(HAS_FLAG(pool_selector, ARGON_POOL_INIT)){
+		bytes += init_pool.bytes;
+	}
+	return bytes;
+}
+
+/**
+ * @brief Forgets the current output buffer before a new one is allocated.
+ * A malloc'd buffer was handed to the caller by argon_init_gas,
+ * who owns it (and might have freed it already): it's left alone.
+ * A growable one can't be released with free(), so argon still owns it
+ */
+static void bfd_data_replace(){
+	if(::bfd_data_kind == BFD_DATA_GROWABLE){
+		argon_bfd_data_free();
+	}
+	::bfd_data_base = 0;
+	::bfd_data_required = 0;
+}
+
+void *argon_bfd_data_alloc(size_t size){
+	bfd_data_replace();
+	// allocate through the real malloc
+	::bfd_data = static_cast<uint8_t *>(__real_malloc(size));
+	if(bfd_data != nullptr){
+		::bfd_data_size = size;
+	}
+	::bfd_data_exec = ::bfd_data;
+	::bfd_data_kind = BFD_DATA_MALLOC;
+	::bfd_data_count = 0;
+	return ::bfd_data;
+}
+
+/**
+ * @brief Allocates an output buffer that grows as needed.
+ * The buffer can move when it grows: use argon_bfd_data_get()
+ * after each write instead of keeping the returned pointer
+ * 
+ * @param size initial size
+ */
+void *argon_bfd_data_alloc_growable(size_t size){
+	size = std::max<size_t>(size, GROWABLE_PAGE_SIZE);
+	size = (size + GROWABLE_PAGE_SIZE - 1) & ~(size_t)(GROWABLE_PAGE_SIZE - 1);
+
+	bfd_data_replace();
+	::bfd_data = growable_map(nullptr, 0, size);
+	::bfd_data_size = (::bfd_data != nullptr) ? size : 0;
+	::bfd_data_exec = ::bfd_data;
+	::bfd_data_kind = BFD_DATA_GROWABLE;
+	::bfd_data_count = 0;
+	return ::bfd_data;
+}
+
+/**
+ * @brief Releases the output buffer, unless it's owned by the caller
+ */
+void argon_bfd_data_free(){
+	switch(::bfd_data_kind){
+		case BFD_DATA_MALLOC:
+			__real_free(::bfd_data);
+			break;
+		case BFD_DATA_GROWABLE:
+			if(::bfd_data != nullptr){
+				growable_unmap(::bfd_data, ::bfd_data_size);
+			}
+			break;
+	}
+	::bfd_data = nullptr;
+	::bfd_data_exec = nullptr;
+	::bfd_data_size = 0;
+	::bfd_data_count = 0;
+	::bfd_data_base = 0;
+	::bfd_data_required = 0;
+	::bfd_data_kind = BFD_DATA_MALLOC;
+}
+
+/**
+ * @brief Returns the current address of the output buffer
+ */
+void *argon_bfd_data_get(){
+	return ::bfd_data;
+}
+
+/**
+ * @brief Returns the size the output buffer would need to hold the last write.
+ * If it's larger than the buffer, the output was truncated
+ */
+size_t argon_bfd_data_required(){
+	return ::bfd_data_required;
+}
+
+/**
+ * @brief Sets a function to call when a write doesn't fit in the output buffer
+ * (i.e. the buffer is fixed size, or it couldn't grow)
+ * 
+ * @param fn callback, or NULL to remove it
+ * @param opaque passed to the callback as is
+ */
+void argon_bfd_data_set_overflow(argon_overflow_fn fn, void *opaque){
+	::bfd_data_overflow_fn = fn;
+	::bfd_data_overflow_opaque = opaque;
+}
+
+/**
+ * @brief Makes GAS write .text directly into caller-owned memory
+ * (e.g. an executable code region), instead of a buffer of its own.
+ * The buffer is never freed by argon.
+ * Use ARGON_KEEP_BUFFER in the following argon_init_gas calls
+ * 
+ * @param mem writable view of the buffer
+ * @param size size of the buffer
+ * @param exec address the buffer is executed from (the RX view of a
+ *   dual mapping), or NULL if it's executed from mem
+ * @return 0 on success, -1 on invalid arguments
+ */
+int argon_bfd_data_set_buffer(void *mem, size_t size, void *exec){
+	if(mem == nullptr || size == 0){
+		return -1;
+	}
+	::bfd_data = static_cast<uint8_t *>(mem);
+	::bfd_data_size = size;
+	::bfd_data_exec = static_cast<uint8_t *>((exec != nullptr) ? exec : mem);
+	::bfd_data_kind = BFD_DATA_USER;
+	::bfd_data_count = 0;
+	::bfd_data_base = 0;
+	return 0;
+}
+
+/**
+ * @brief Returns the address the .text of the last write executes at
+ */
+void *argon_bfd_data_exec_addr(){
+	if(::bfd_data_exec == nullptr){
+		return nullptr;
+	}
+	return &::bfd_data_exec[::bfd_data_base];
+}
+
+size_t argon_bfd_data_written(){
+	return ::bfd_data_count;
+}
+
+/**
+ * @brief Starts a new write: .text will be written at the current position,
+ * and the section table is emptied
+ */
+void argon_bfd_data_begin(){
+	::bfd_data_base = ::bfd_data_count;
+	::bfd_data_required = ::bfd_data_count;
+	::out_nactive = 0;
+	::out_nsymbols = 0;
+	::out_nfixups = 0;
+	::out_nresolved = 0;
+	::out_noverflow = 0;
+	::out_strtab_size = 0;
+}
+
+/**
+ * @brief Sets the address the output buffer is placed at.
+ * References to .text and to absolute addresses (e.g. "call 0x401000")
+ * are then resolved in the output, instead of being left as fixups
+ * 
+ * @param vma address of the start of the buffer
+ */
+void argon_bfd_data_set_vma(uint64_t vma){
+	::bfd_data_vma = vma;
+	::bfd_data_vma_set = true;
+}
+
+/**
+ * @brief Goes back to position independent output (the default)
+ */
+void argon_bfd_data_clear_vma(){
+	::bfd_data_vma = 0;
+	::bfd_data_vma_set = false;
+}
+
+/**
+ * @brief Returns the number of relocations of the last write
+ * resolved against the address set by argon_bfd_data_set_vma
+ */
+size_t argon_bfd_data_resolved_count(){
+	return ::out_nresolved;
+}
+
+/**
+ * @brief Returns the number of relocations of the last write that
+ * argon_bfd_data_set_vma couldn't resolve because the target is out of range.
+ * They are left as fixups (argon_bfd_data_fixup_*)
+ */
+size_t argon_bfd_data_overflow_count(){
+	return ::out_noverflow;
+}
+
+/**
+ * @brief Starts a new write made of a single section,
+ * as if it was written by write_object_file (e.g. cached output)
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int argon_bfd_data_emit(const char *section_name, unsigned flags, unsigned alignment, const void *data, size_t size){
+	argon_bfd_data_begin();
+	struct out_section *out = out_section_get(section_name, flags, alignment);
+	if(out == nullptr){
+		return -1;
+	}
+	return out_write(out, data, 0, size) ? 0 : -1;
+}
+
+size_t argon_bfd_data_section_count(){
+	return ::out_nactive;
+}
+
+/**
+ * @brief Describes a section written by the last write
+ * 
+ * @param index index in the section table, in write order
+ * @param[out] section
+ * @return 0 on success, -1 if the index is out of range
+ */
+int argon_bfd_data_section_get(size_t index, struct argon_section *section){
+	if(index >= ::out_nactive){
+		return -1;
+	}
+	struct out_section *out = ::out_active[index];
+	section->name = out->name;
+	section->flags = out->flags;
+	section->alignment = out->alignment;
+	section->size = out->size;
+	section->data = (out->data != nullptr)
+		? out->data
+		: &::bfd_data[::bfd_data_base];
+	return 0;
+}
+
+int argon_bfd_data_section_find(const char *name, struct argon_section *section){
+	for(size_t i=0; i<::out_nactive; i++){
+		if(!strcmp(::out_active[i]->name, name)){
+			return argon_bfd_data_section_get(i, section);
+		}
+	}
+	return -1;
+}
+
+size_t argon_bfd_data_symbol_count(){
+	return ::out_nsymbols;
+}
+
+/**
+ * @brief Describes a symbol of the last write
+ * 
+ * @param index index in the symbol table
+ * @param[out] symbol
+ * @return 0 on success, -1 if the index is out of range
+ */
+int argon_bfd_data_symbol_get(size_t index, struct argon_symbol *symbol){
+	if(index >= ::out_nsymbols){
+		return -1;
+	}
+	struct out_symbol *out = &::out_symbols[index];
+	symbol->name = out_strtab_get(out->name);
+	symbol->section = out_strtab_get(out->section);
+	symbol->value = out->value;
+	symbol->flags = out->flags;
+	return 0;
+}
+
+int argon_bfd_data_symbol_find(const char *name, struct argon_symbol *symbol){
+	for(size_t i=0; i<::out_nsymbols; i++){
+		const char *sym_name = out_strtab_get(::out_symbols[i].name);
+		if(sym_name != nullptr && !strcmp(sym_name, name)){
+			return argon_bfd_data_symbol_get(i, symbol);
+		}
+	}
+	return -1;
+}
+
+size_t argon_bfd_data_fixup_count(){
+	return ::out_nfixups;
+}
+
+/**
+ * @brief Describes a relocation left unresolved by the last write
+ * 
+ * @param index index in the fixup table, in section order
+ * @param[out] fixup
+ * @return 0 on success, -1 if the index is out of range
+ */
+int argon_bfd_data_fixup_get(size_t index, struct argon_fixup *fixup){
+	if(index >= ::out_nfixups){
+		return -1;
+	}
+	struct out_fixup *out = &::out_fixups[index];
+	fixup->section = out_strtab_get(out->section);
+	fixup->symbol = out_strtab_get(out->symbol);
+	fixup->type_name = out_strtab_get(out->type_name);
+	fixup->offset = out->offset;
+	fixup->addend = out->addend;
+	fixup->size = out->size;
+	fixup->type = out->type;
+	fixup->pc_relative = out->pc_relative;
+	return 0;
+}
+
+/**
+ * @brief Returns the relocation howto of a fixup of the last write,
+ * to be used with argon_bfd_data_patch
+ */
+const void *argon_bfd_data_fixup_howto(size_t index){
+	if(index >= ::out_nfixups){
+		return nullptr;
+	}
+	return ::out_fixups[index].howto;
+}
+
+/**
+ * @brief Resolves a relocation in the output buffer
+ * 
+ * @param howto relocation howto (argon_bfd_data_fixup_howto)
+ * @param pos position of the field in the output buffer
+ * @param target position of the target in the output buffer
+ * @param addend
+ * @return 0 on success, -1 if the field is out of bounds or the value overflows it
+ */
+int argon_bfd_data_patch(const void *howto, size_t pos, size_t target, int64_t addend){
+	auto rel_howto = static_cast<reloc_howto_type *>(const_cast<void *>(howto));
+	size_t size = bfd_get_reloc_size(rel_howto);
+	if(::bfd_data == nullptr || pos + size > ::bfd_data_size){
+		return -1;
+	}
+
+	// addresses are taken from the executable view, or from the vma
+	bfd_vma base = ::bfd_data_vma_set
+		? ::bfd_data_vma
+		: reinterpret_cast<uintptr_t>(::bfd_data_exec);
+	bfd_vma value = base + target + addend;
+	if(rel_howto->pc_relative){
+		value -= base + pos;
+	}
+	bfd_reloc_status_type status = _bfd_relocate_contents(
+		rel_howto, static_cast<bfd *>(stdoutput), value, &::bfd_data[pos]);
+
+	if(::bfd_data_kind == BFD_DATA_USER){
+		__builtin___clear_cache(
+			reinterpret_cast<char *>(&::bfd_data_exec[pos]),
+			reinterpret_cast<char *>(&::bfd_data_exec[pos + size]));
+	}
+	return (status == bfd_reloc_ok) ? 0 : -1;
+}
+
+void argon_fseek(long offset, int whence){
+	size_t p = ::bfd_data_count;
+	switch(whence){
+		case SEEK_SET:
+			p = offset;
+			break;
+		case SEEK_END:
+			p += ::bfd_data_size + offset;
+			break;
+		case SEEK_CUR:
+			p += offset;
+			break;
+	}
+	::bfd_data_count = p;
+}
+
+#define FAKE_OUTPUT_HANDLE (FILE *)(-2)
+
+extern int __real_fclose(FILE *stream);
+int __wrap_fclose(FILE *stream){
+	if(stream == FAKE_OUTPUT_HANDLE){
+		return 0;
+	}
+	return __real_fclose(stream);
+}
+
+FILE *__wrap__bfd_real_fopen (const char *filename, const char *modes){
+	(void)filename;
+	(void)modes;
+	return FAKE_OUTPUT_HANDLE;
+}
+
+/**
+ * in-memory source for the GAS reader (input_file_open):
+ * opening "stream_name" reads from stream_data instead
+ */
+static const char *stream_name ARGON_PERSIST = nullptr;
+static const void *stream_data ARGON_PERSIST = nullptr;
+static size_t stream_size ARGON_PERSIST = 0;
+
+/**
+ * @brief Sets the contents of a file name that GAS will read from memory
+ * 
+ * @param name file name, or NULL to disable
+ * @param data source text, must stay valid while GAS reads it
+ * @param size size of data
+ */
+void argon_stream_source_set(const char *name, const void *data, size_t size){
+	::stream_name = name;
+	::stream_data = data;
+	::stream_size = size;
+}
+
+extern FILE *__real_fopen(const char *filename, const char *modes);
+FILE *__wrap_fopen(const char *filename, const char *modes){
+	if(::stream_name != nullptr && !strcmp(filename, ::stream_name)){
+	#ifdef WIN32
+		return nullptr;
+	#else
+		(void)modes;
+		return fmemopen(const_cast<void *>(::stream_data), ::stream_size, "r");
+	#endif
+	}
+	return __real_fopen(filename, modes);
 }
 }
\ No newline at end of file